@@ -3,11 +3,11 @@
 
 
 void execute_process_iteratively ()
-{ int round, i;
+{ int round;
 
   fprintf (infF, "Iterative execution: #rounds? ");
   scanf ("%d", &round);
-  for (i=0; i<round; i++) execute_process();
+  execute_rounds (round);   // on every core
 }
 
 void one_admin_command (char act)
@@ -19,13 +19,13 @@ void one_admin_command (char act)
     case 's':  // submit a program: should not be admin's command
       submission (); break;
     case 'x':  // execute once, duplicate with y, but more convenient
-      execute_process (); break;
+      execute_rounds (1); break;
     case 'y':  // multiple rounds of execution
       execute_process_iteratively (); break;
     case 'q':  // dump ready queue and list of processes completed IO
       dump_MLFQ  (stdout); dump_endIO_list (stdout); break;
     case 'r':   // dump the list of available PCBs
-      dump_registers (stdout); break;
+      dump_core_registers (stdout); break;
     case 'p':   // dump the list of available PCBs
       dump_PCB_list (stdout); break;
     case 'm':   // dump memory of each process
@@ -35,11 +35,31 @@ void one_admin_command (char act)
     case 'n':   // dump the content of the entire memory
       dump_memory (); break;
     case 'e':   // dump events in clock.c
-      dump_events (stdout); break;
+      dump_core_events (); break;
     case 't':   // dump terminal IO queue
       dump_termIO_queue (stdout); break;
     case 'w':   // dump swap queue
       dump_swapQ (stdout); break;
+    case 'l':   // dump TLB entries and hit/miss counters
+      dump_tlb (stdout); break;
+    case 'u':   // dump superinstruction coverage of each process
+      dump_PCB_fusion (stdout); break;
+    case 'j':   // dump JIT statistics
+      dump_jit (stdout); break;
+    case 'i':   // dump pending interrupts and their delivery latency
+      dump_interrupts (stdout); break;
+    case 'o':   // turn the execution profiler on/off
+      toggle_profiler (); break;
+    case 'g':   // dump the profile and write it as folded stacks
+      dump_profile (stdout); write_profile_folded (); break;
+    case 'c':   // checkpoint the whole machine
+      save_checkpoint (); break;
+    case 'k':   // restore the machine from the checkpoint
+      restore_checkpoint (); break;
+    case 'h':   // dump cache hit rates and stalls of each process
+      dump_cache (stdout); break;
+    case 'a':   // dump the resource usage of each process
+      dump_rusage_list (stdout); break;
     default:   // can be used to yield to client submission input
       fprintf (infF, "Error: Incorrect command!!!\n");
   }
@@ -0,0 +1,198 @@
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <stdlib.h>
+#include "simos.h"
+
+//=========================================================================
+// Cache hierarchy model
+// When cacheModel is set, every access that memory.c (get_data, put_data,
+//    get_instruction) and vector.c make to Memory[] goes through a model
+//    of a set-associative L1 and L2 cache on the physical address (the
+//    index in Memory[]); only the tags are kept, the data stays in Memory
+// Each core has its own L1 and L2, there is no coherence between cores
+//    (a process only runs on one core at a time, which is what we measure)
+// Write-back, write-allocate; a line is lineWords memory words
+//    replacement (cacheRepl): 0 LRU, 1 FIFO, 2 random, the same for both levels
+// An L1 miss that hits in L2 stalls the core for L2stall cycles, a miss in
+//    both for memStall cycles; the stalls are counted for each process and,
+//    when stallsToClock is set, added to the clock (CPU.numCycles) by the
+//    switch engine, so timers and time quanta see the cache behaviour
+// The model needs every access, so cpu.c runs the switch engine with it
+// Admin command h prints the hit rates and stalls of each process
+//=========================================================================
+
+#define replLRU 0
+#define replFIFO 1
+#define replRandom 2
+
+typedef struct
+{ int tag;          // line address (maddr / lineWords), -1 if invalid
+  unsigned stamp;   // LRU: last access, FIFO: fill
+  int dirty;
+} typeCacheLine;
+
+typedef struct
+{ int numSets, assoc;
+  typeCacheLine *lines;   // numSets*assoc, the ways of a set are adjacent
+  unsigned clock;         // access counter for the stamps
+  unsigned seed;          // random replacement
+} typeCache;
+
+typedef struct
+{ unsigned l1Hits, l1Misses, l2Hits, l2Misses, writebacks;
+  long long stalls;
+} typeCacheStat;
+
+typeCache *L1cache, *L2cache;   // one of each for every core
+typeCacheStat *cacheStat;       // for each pid
+
+char *replName[] = { "LRU", "FIFO", "random" };
+
+void init_cache_level (typeCache *c, int lines, int assoc, int core)
+{ int i;
+
+  if (assoc < 1) assoc = 1;
+  if (lines < assoc) lines = assoc;
+  c->assoc = assoc;
+  c->numSets = lines / assoc;
+  c->lines = (typeCacheLine *) malloc (c->numSets*assoc*sizeof(typeCacheLine));
+  for (i=0; i<c->numSets*assoc; i++)
+  { c->lines[i].tag = -1; c->lines[i].stamp = 0; c->lines[i].dirty = 0; }
+  c->clock = 0;
+  c->seed = core + 1;
+}
+
+// called by system.c
+void initialize_cache ()
+{ int k;
+
+  if (!cacheModel) return;
+  if (lineWords < 1) lineWords = 1;
+  if (cacheRepl < replLRU || cacheRepl > replRandom) cacheRepl = replLRU;
+  L1cache = (typeCache *) malloc (numCores*sizeof(typeCache));
+  L2cache = (typeCache *) malloc (numCores*sizeof(typeCache));
+  for (k=0; k<numCores; k++)
+  { init_cache_level (&L1cache[k], L1lines, L1assoc, k);
+    init_cache_level (&L2cache[k], L2lines, L2assoc, k);
+  }
+  cacheStat = (typeCacheStat *) calloc (maxProcess, sizeof(typeCacheStat));
+}
+
+// look line up in cache c, fill it on a miss; returns 1 on a hit
+// *evicted is the dirty line thrown out for the fill, -1 if none
+int cache_lookup (typeCache *c, int line, int write, int *evicted)
+{ typeCacheLine *set, *victim;
+  int i;
+
+  *evicted = -1;
+  c->clock++;
+  set = &c->lines[(line % c->numSets) * c->assoc];
+  for (i=0; i<c->assoc; i++)
+    if (set[i].tag == line)
+    { if (cacheRepl == replLRU) set[i].stamp = c->clock;
+      if (write) set[i].dirty = 1;
+      return (1);
+    }
+  victim = NULL;
+  for (i=0; i<c->assoc && victim==NULL; i++)
+    if (set[i].tag < 0) victim = &set[i];
+  if (victim == NULL && cacheRepl == replRandom)
+    victim = &set[rand_r (&c->seed) % c->assoc];
+  else if (victim == NULL)   // LRU and FIFO: the oldest stamp
+  { victim = &set[0];
+    for (i=1; i<c->assoc; i++)
+      if (set[i].stamp < victim->stamp) victim = &set[i];
+  }
+  if (victim->tag >= 0 && victim->dirty) *evicted = victim->tag;
+  victim->tag = line;
+  victim->stamp = c->clock;
+  victim->dirty = write;
+  return (0);
+}
+
+// called by memory.c and vector.c after a successful translation
+// the stall cycles are added to CPU.stallCycles
+void cache_access (int maddr, int rwflag)
+{ typeCacheStat *st;
+  int core, line, write, evicted, wb;
+
+  core = CPU.coreId;
+  line = maddr / lineWords;
+  write = (rwflag == flagWrite);
+  st = (CPU.Pid >= 0 && CPU.Pid < maxProcess) ? &cacheStat[CPU.Pid] : NULL;
+  if (cache_lookup (&L1cache[core], line, write, &evicted))
+  { if (st != NULL) st->l1Hits++;
+    return;
+  }
+  if (evicted >= 0)   // the dirty L1 line is written into L2
+  { cache_lookup (&L2cache[core], evicted, 1, &wb);
+    if (wb >= 0 && st != NULL) st->writebacks++;
+  }
+  if (cache_lookup (&L2cache[core], line, 0, &wb))
+  { if (st != NULL) { st->l1Misses++; st->l2Hits++; st->stalls += L2stall; }
+    CPU.stallCycles = CPU.stallCycles + L2stall;
+  }
+  else
+  { if (st != NULL) { st->l1Misses++; st->l2Misses++; st->stalls += memStall; }
+    CPU.stallCycles = CPU.stallCycles + memStall;
+  }
+  if (wb >= 0 && st != NULL) st->writebacks++;
+}
+
+// n consecutive words, a vector instruction: one access per line
+void cache_access_range (int maddr, int n, int rwflag)
+{ int line, last;
+
+  last = (maddr + n - 1) / lineWords;
+  for (line = maddr / lineWords; line <= last; line++)
+    cache_access (line * lineWords, rwflag);
+}
+
+// the frame gets another page (paging.c), its lines are dropped from the
+// caches of all cores; called with memLock held exclusively
+void cache_flush_frame (int findex)
+{ typeCache *c;
+  int k, level, i, first, last;
+
+  if (!cacheModel) return;
+  first = findex * pageSize / lineWords;
+  last = ((findex + 1) * pageSize - 1) / lineWords;
+  for (k=0; k<numCores; k++)
+    for (level=0; level<2; level++)
+    { c = (level == 0) ? &L1cache[k] : &L2cache[k];
+      for (i=0; i<c->numSets*c->assoc; i++)
+        if (c->lines[i].tag >= first && c->lines[i].tag <= last)
+        { c->lines[i].tag = -1; c->lines[i].dirty = 0; }
+    }
+}
+
+void dump_cache_process (FILE *outf, int pid)
+{ typeCacheStat *st;
+  unsigned l1, l2;
+
+  if (!cacheModel || pid < 0 || pid >= maxProcess) return;
+  st = &cacheStat[pid];
+  l1 = st->l1Hits + st->l1Misses;
+  l2 = st->l2Hits + st->l2Misses;
+  if (l1 == 0) return;
+  fprintf (outf, "Process %d cache: L1 %u/%u hits (%.2f%%), ",
+           pid, st->l1Hits, l1, 100.0 * st->l1Hits / l1);
+  fprintf (outf, "L2 %u/%u hits (%.2f%%), writebacks=%u, stalls=%lld\n",
+           st->l2Hits, l2, (l2 == 0) ? 0.0 : 100.0 * st->l2Hits / l2,
+           st->writebacks, st->stalls);
+}
+
+// called by admin.c
+void dump_cache (FILE *outf)
+{ int pid;
+
+  if (!cacheModel) { fprintf (outf, "Cache model is off\n"); return; }
+  fprintf (outf, "******************** Cache Dump\n");
+  fprintf (outf, "L1: %d sets x %d ways, L2: %d sets x %d ways, ",
+           L1cache[0].numSets, L1cache[0].assoc,
+           L2cache[0].numSets, L2cache[0].assoc);
+  fprintf (outf, "line=%d words, %s, stalls L2=%d mem=%d%s\n",
+           lineWords, replName[cacheRepl], L2stall, memStall,
+           stallsToClock ? ", on the clock" : "");
+  for (pid=idlePid+1; pid<maxProcess; pid++) dump_cache_process (outf, pid);
+}
@@ -0,0 +1,207 @@
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "simos.h"
+
+//=========================================================================
+// Whole-machine checkpoint
+// save_checkpoint writes the state of the simulated machine to
+//    "simos.ckpt": the PCBs and page tables, ready queues and endIO list
+//    (process.c), Memory[] and the frame table (paging.c), the registers
+//    of every core (cpu.c), the timers (clock.c), the swap queue with the
+//    content of swap.disk (swap.c) and the terminal queue (term.c)
+// restore_checkpoint maps the file and copies every part back in place,
+//    so a long warm-up is run once and restored in milliseconds;
+//    derived state is rebuilt instead of saved: decoded pages (icache.c)
+//    of the resident code pages, the TLBs start empty
+// Each module saves and restores its own part through ckpt_write and
+//    ckpt_read, restore reads the parts in the order they were written
+// Both are called between rounds (admin.c) or before the first one
+//    (system.c): no core runs, memLock and the swap and terminal queue
+//    locks are held, so the device threads stand still
+//=========================================================================
+
+#define ckptFname "simos.ckpt"
+#define ckptMagic 0x54504b43   // "CKPT"
+
+// the sizes the saved state depends on, a restore needs the same
+typedef struct
+{ int magic;
+  int mwordBytes, mdBytes;   // build: word format and memory data type
+  int maxProcess, pageSize, numFrames, loadPpages, maxPpages, OSpages;
+  int numCores;
+} typeCkptHeader;
+
+FILE *fckpt;
+char *ckptMap, *ckptPtr;   // restore: the mapped file and the read position
+long long ckptSize;
+
+void ckpt_write (void *data, long long size)
+{
+  if (size > 0 && (long long) fwrite (data, 1, size, fckpt) != size)
+    fprintf (infF, "Error writing %s\n", ckptFname);
+}
+
+void ckpt_write_int (int v)
+{ ckpt_write (&v, sizeof(int)); }
+
+// pointer to the next size bytes of the checkpoint
+void *ckpt_read (long long size)
+{ char *p;
+
+  p = ckptPtr;
+  if (ckptPtr + size > ckptMap + ckptSize)
+  { printf ("Error: %s is truncated\n", ckptFname); exit (-1); }
+  ckptPtr = ckptPtr + size;
+  return (p);
+}
+
+int ckpt_read_int ()
+{ int v;
+
+  memcpy (&v, ckpt_read (sizeof(int)), sizeof(int));
+  return (v);
+}
+
+void fill_header (typeCkptHeader *h)
+{
+  memset (h, 0, sizeof(typeCkptHeader));
+  h->magic = ckptMagic;
+  h->mwordBytes = sizeof(mwordType); h->mdBytes = sizeof(mdType);
+  h->maxProcess = maxProcess; h->pageSize = pageSize;
+  h->numFrames = numFrames; h->loadPpages = loadPpages;
+  h->maxPpages = maxPpages; h->OSpages = OSpages;
+  h->numCores = numCores;
+}
+
+double ckpt_msec (struct timespec *t0)
+{ struct timespec t1;
+
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  return ((t1.tv_sec - t0->tv_sec) * 1e3 + (t1.tv_nsec - t0->tv_nsec) / 1e6);
+}
+
+//==========================
+// save
+//==========================
+
+// called by admin.c
+void save_checkpoint ()
+{ typeCkptHeader h;
+  struct timespec t0;
+  long long size;
+
+  if (traceMode)
+  { fprintf (infF, "Checkpoints are not taken while tracing\n"); return; }
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  fckpt = fopen (ckptFname, "w");
+  if (fckpt == NULL) { perror ("Error open checkpoint: "); return; }
+  setvbuf (fckpt, NULL, _IOFBF, 1<<20);
+
+  memory_lock_exclusive ();
+  lock_swapQ ();
+  lock_termQ ();
+  fill_header (&h);
+  ckpt_write (&h, sizeof(h));
+  checkpoint_processes ();   // first, the other parts need the PCBs back
+  checkpoint_memory ();
+  checkpoint_cpu ();
+  checkpoint_timers ();
+  checkpoint_swap ();
+  checkpoint_term ();
+  unlock_termQ ();
+  unlock_swapQ ();
+  memory_unlock ();
+
+  size = ftell (fckpt);
+  fclose (fckpt);
+  fprintf (infF, "Checkpoint %s at cycle %d: %lld bytes, %.3f ms\n",
+           ckptFname, cpuCores[bootCore].numCycles, size, ckpt_msec (&t0));
+}
+
+//==========================
+// restore
+//==========================
+
+int map_checkpoint ()
+{ struct stat st;
+  int fd;
+
+  fd = open (ckptFname, O_RDONLY);
+  if (fd < 0) { perror ("Error open checkpoint: "); return (0); }
+  fstat (fd, &st);
+  ckptSize = st.st_size;
+  ckptMap = (char *) mmap (NULL, ckptSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (ckptMap == MAP_FAILED)
+  { perror ("Error mmap checkpoint: "); return (0); }
+  ckptPtr = ckptMap;
+  if (ckptSize < (long long) sizeof(typeCkptHeader)
+      || ((typeCkptHeader *) ckptMap)->magic != ckptMagic)
+  { fprintf (infF, "%s is not a checkpoint\n", ckptFname);
+    munmap (ckptMap, ckptSize);
+    return (0);
+  }
+  return (1);
+}
+
+// called by configure_system when the system starts from a checkpoint:
+// the sizes are taken from it, before the modules are initialized
+void checkpoint_config ()
+{ typeCkptHeader *h;
+
+  if (!map_checkpoint ()) { ckptRestore = 0; return; }
+  h = (typeCkptHeader *) ckptMap;
+  maxProcess = h->maxProcess; pageSize = h->pageSize;
+  numFrames = h->numFrames; loadPpages = h->loadPpages;
+  maxPpages = h->maxPpages; OSpages = h->OSpages;
+  numCores = h->numCores;
+  munmap (ckptMap, ckptSize);
+}
+
+// called by admin.c, and by system.c at start-up when ckptRestore is set
+void restore_checkpoint ()
+{ typeCkptHeader h;
+  struct timespec t0;
+
+  if (traceMode)
+  { fprintf (infF, "Checkpoints are not restored while tracing\n"); return; }
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  if (!map_checkpoint ()) return;
+  fill_header (&h);
+  if (memcmp (&h, ckptMap, sizeof(h)) != 0)
+  { fprintf (infF, "%s was taken with another configuration or build\n",
+             ckptFname);
+    munmap (ckptMap, ckptSize);
+    return;
+  }
+  ckpt_read (sizeof(h));
+
+  memory_lock_exclusive ();
+  lock_swapQ ();
+  lock_termQ ();
+  if (!swapQ_empty () || !termQ_empty ())
+    // the device threads hold on to the node they work on
+    fprintf (infF, "Devices are busy, try the restore again later\n");
+  else
+  { restore_processes ();
+    restore_memory ();
+    restore_cpu ();
+    restore_timers ();
+    restore_swap ();
+    restore_term ();
+    fprintf (infF, "Restored %s, cycle %d: %lld bytes, %.3f ms\n",
+             ckptFname, cpuCores[bootCore].numCycles, ckptSize,
+             ckpt_msec (&t0));
+  }
+  unlock_termQ ();
+  unlock_swapQ ();
+  memory_unlock ();
+  munmap (ckptMap, ckptSize);
+}
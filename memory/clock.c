@@ -18,12 +18,40 @@ void advance_clock ()
   check_timer ();
 }
 
+// advance the clock by n cycles at once, the caller has to make sure
+// that no timer is due before the last of these cycles
+void advance_clock_by (int n)
+{ CPU.numCycles += n;
+  if (CPU.numCycles > maxCPUcycles)
+    { printf ("CPU cycle count exceeds its limit!!!\n"); exit(-1); }
+  check_timer ();
+}
+
+// kernel overhead: the OS work of a context switch, a page fault, an
+// interrupt dispatch or a timer operation takes osCost[kind] cycles of
+// the core; they are counted for the core, execute_process gives the
+// overhead during a round to the process as its osTime
+void charge_os (int kind)
+{
+  if (osCost[kind] <= 0) return;
+  CPU.numCycles += osCost[kind];
+  if (CPU.numCycles > maxCPUcycles)
+    { printf ("CPU cycle count exceeds its limit!!!\n"); exit(-1); }
+  CPU.osCycles[kind] += osCost[kind];
+  CPU.osTime += osCost[kind];
+  // a timer that becomes due is handled at the next check_timer
+}
+
 // We need to build a timer list, in sorted order
 // only the first event in the list will be checked to see
 // whether its time is up
 // To make insertion efficient, we keep a binary tree of events
 // while using a eventHead pointer to point to the leftmost node
 //
+// Each core has its own event tree (CPU.eventTree, CPU.eventHead) and is
+// timed by its own clock, like a local timer of the core. A timer is set
+// on the core of the caller and fires on that core
+//
 // eventNode is defined to keep track of timer events and
 // to maintain the event tree (and list)
 // The fields: time, pid, act, recurP belong to the timer event level
@@ -39,21 +67,21 @@ struct eventNode
   struct eventNode *left, *right;
   struct eventNode *parent;
               // keep parent node to make removal of head node easier
-} *eventTree, *eventHead;
+};
 
 
 // the event tree has a dummy node to begin with, with the highest time
 void initialize_eventtree ()
 {
-  eventTree = (struct eventNode *) malloc (sizeof (struct eventNode));
-  eventTree->time = maxCPUcycles + 1;
-  eventTree->pid = 0;
-  eventTree->act = 0;
-  eventTree->recurP = 0;
-  eventTree->left = NULL;
-  eventTree->right = NULL;
-  eventTree->parent = NULL;
-  eventHead = eventTree;
+  CPU.eventTree = (struct eventNode *) malloc (sizeof (struct eventNode));
+  CPU.eventTree->time = maxCPUcycles + 1;
+  CPU.eventTree->pid = 0;
+  CPU.eventTree->act = 0;
+  CPU.eventTree->recurP = 0;
+  CPU.eventTree->left = NULL;
+  CPU.eventTree->right = NULL;
+  CPU.eventTree->parent = NULL;
+  CPU.eventHead = CPU.eventTree;
 }
 
 void insert_event (event)
@@ -63,13 +91,13 @@ struct eventNode *event;
   event->left = NULL;
   event->right = NULL;
 
-  cnode = eventTree;
+  cnode = CPU.eventTree;
   while (cnode != NULL)
   { if (event->time < cnode->time)
       if (cnode->left == NULL)
       { cnode->left = event;
         event->parent = cnode;
-        if (eventHead == cnode) eventHead = event;
+        if (CPU.eventHead == cnode) CPU.eventHead = event;
          // the new event has a lower time, eventHead should point to it
         break;
       }
@@ -92,14 +120,14 @@ struct eventNode *event;
 void remove_eventhead ()
 { struct eventNode *event, *temp;
 
-  event = eventHead;
+  event = CPU.eventHead;
   if (event->right != NULL)
   { temp = event->right;
     while (temp->left != NULL) temp = temp->left;
-    eventHead = temp;
+    CPU.eventHead = temp;
     event->right->parent = event->parent;
   }
-  else eventHead = event->parent;
+  else CPU.eventHead = event->parent;
   event->parent->left = event->right;
 }
 
@@ -121,20 +149,97 @@ struct eventNode *event;
 }
 
 void dump_events ()
-{ printf ("Now = %d, Head: time=%d, pid=%d, action=%d, recurP=%d\n",
-           CPU.numCycles, eventHead->time,
-           eventHead->pid, eventHead->act, eventHead->recurP);
-  list_events (eventTree);
+{ if (numCores > 1) printf ("Core %d: ", CPU.coreId);
+  printf ("Now = %d, Head: time=%d, pid=%d, action=%d, recurP=%d\n",
+           CPU.numCycles, CPU.eventHead->time,
+           CPU.eventHead->pid, CPU.eventHead->act, CPU.eventHead->recurP);
+  list_events (CPU.eventTree);
+}
+
+// events of all the cores, called by admin.c
+void dump_core_events ()
+{ typeCPU *self;
+  int k;
+
+  self = thisCore;
+  for (k=0; k<numCores; k++) { bind_core (k); dump_events (); }
+  thisCore = self;
+}
+
+
+//=============================================================
+// checkpoint (checkpoint.c): the events of each core in pre-order,
+// inserting them in that order builds the same tree again
+//=============================================================
+
+int count_events (struct eventNode *event)
+{
+  if (event == NULL) return (0);
+  return (1 + count_events (event->left) + count_events (event->right));
+}
+
+void save_events (struct eventNode *event)
+{
+  if (event == NULL) return;
+  ckpt_write_int (event->time); ckpt_write_int (event->pid);
+  ckpt_write_int (event->act); ckpt_write_int (event->recurP);
+  save_events (event->left);
+  save_events (event->right);
+}
+
+void free_events (struct eventNode *event)
+{
+  if (event == NULL) return;
+  free_events (event->left);
+  free_events (event->right);
+  free (event);
+}
+
+void checkpoint_timers ()
+{ typeCPU *self;
+  int k;
+
+  self = thisCore;
+  for (k=0; k<numCores; k++)
+  { bind_core (k);
+    ckpt_write_int (count_events (CPU.eventTree->left)
+                    + count_events (CPU.eventTree->right));
+    save_events (CPU.eventTree->left);   // the dummy root is not saved
+    save_events (CPU.eventTree->right);
+  }
+  thisCore = self;
 }
 
+void restore_timers ()
+{ struct eventNode *event;
+  typeCPU *self;
+  int k, n;
+
+  self = thisCore;
+  for (k=0; k<numCores; k++)
+  { bind_core (k);
+    free_events (CPU.eventTree);
+    initialize_eventtree ();
+    for (n = ckpt_read_int (); n > 0; n--)
+    { event = malloc (sizeof (struct eventNode));
+      event->time = ckpt_read_int (); event->pid = ckpt_read_int ();
+      event->act = ckpt_read_int (); event->recurP = ckpt_read_int ();
+      insert_event (event);
+    }
+  }
+  thisCore = self;
+}
 
 //=============================================================
 // high level timer calls
 //
 
+// called after initialize_cpu, every core gets an empty event tree
 void initialize_timer ()
-{
-  initialize_eventtree();
+{ int k;
+
+  for (k=0; k<numCores; k++) { bind_core (k); initialize_eventtree(); }
+  bind_core (bootCore);
 }
 
 genericPtr add_timer (time, pid, action, recurperiod)
@@ -154,16 +259,40 @@ int time, pid, action, recurperiod; // time is from current time
     insert_event (event);
     if (Debug) printf ("Add timer: time=%d, pid=%d, action=%d, recurP=%d\n",
                        event->time, event->pid, event->act, event->recurP);
+    charge_os (osTimer);   // after the timer is set relative to now
     return ((genericPtr) event);
       // to not expose the eventNode structure, a casted pointer is returned
   }
 }
 
+// number of cycles till the earliest event, at least 1
+// the dummy node of the event tree bounds it when there is no event
+int cycles_to_next_timer ()
+{ int cycles;
+
+  cycles = CPU.eventHead->time - CPU.numCycles;
+  if (cycles < 1) cycles = 1;
+  return (cycles);
+}
+
+// free-running mode: a device takes usec/instrTime cycles for a request
+// and serves its requests in order, busyUntil is the cycle at which it
+// finishes the last one; returns #cycles from now till the new one is done
+int device_delay (int *busyUntil, int usec)
+{ int cycles;
+
+  cycles = (instrTime > 0) ? (usec + instrTime - 1) / instrTime : usec;
+  if (cycles < 1) cycles = 1;
+  if (*busyUntil < CPU.numCycles) *busyUntil = CPU.numCycles;
+  *busyUntil = *busyUntil + cycles;
+  return (*busyUntil - CPU.numCycles);
+}
+
 void check_timer ()
 { struct eventNode *event;
 
-  while (eventHead->time <= CPU.numCycles)
-  { event = eventHead;
+  while (CPU.eventHead->time <= CPU.numCycles)
+  { event = CPU.eventHead;
     if (clockDebug)
     { printf ("Process event: time=%d, pid=%d, action=%d, recurP=%d\n",
               event->time, event->pid, event->act, event->recurP);
@@ -180,6 +309,22 @@ void check_timer ()
         insert_endIO_list (event->pid);
         set_interrupt (endIOinterrupt);
         break;
+      case actDiskDone:   // the device thread may still be doing the job
+      case actTermDone:
+        if (event->act == actDiskDone) wait_disk_done ();
+        else wait_term_done ();
+        if (event->pid != nullPid)
+        { insert_endIO_list (event->pid);
+          set_interrupt (endIOinterrupt);
+        }
+        break;
+      case actPrefetchDone:
+        wait_disk_done ();
+        if (prefetch_waiting (event->pid))
+        { insert_endIO_list (event->pid);
+          set_interrupt (endIOinterrupt);
+        }
+        break;
       case actNull:
         if (clockDebug)
           printf ("Event: time=%d, pid=%d, action=%d, recurP=%d\n",
@@ -212,6 +357,7 @@ genericPtr castedevent;
 
   event = (struct eventNode *) castedevent;
   event->act = actNull;
+  charge_os (osTimer);
   if (clockDebug)
     printf("Deactivate event: addr=%x, time=%d, pid=%d, action=%d, reP=%d\n",
           castedevent, event->time, event->pid, event->act, event->recurP);
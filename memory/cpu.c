@@ -1,27 +1,73 @@
 
 #define _XOPEN_SOURCE 500
+#include <time.h>
 #include "simos.h"
 
-// opcode definitions
-#define OPload 2
-#define OPadd 3
-#define OPmul 4
-#define OPifgo 5
-#define OPstore 6
-#define OPprint 7
-#define OPsleep 8
-#define OPload2 9
-#define OPexit 1
 
+__thread typeCPU *thisCore = NULL;
 
 void initialize_cpu ()
-{ // Generally, cpu goes to a fix location to fetch and execute OS
-  CPU.interruptV = 0;
-  CPU.numCycles = 0;
+{ int i, k;
+
+  cpuCores = (typeCPU *) malloc (numCores*sizeof(typeCPU));
+  for (k=0; k<numCores; k++)
+  { bind_core (k);
+    CPU.coreId = k;
+    CPU.Pid = nullPid;
+    // Generally, cpu goes to a fix location to fetch and execute OS
+    CPU.interruptV = 0;
+    CPU.interruptMask = 0;
+    for (i=0; i<numIntSources; i++)
+    { CPU.intStat[i].raised = 0; CPU.intStat[i].served = 0;
+      CPU.intStat[i].raisedAt = 0; CPU.intStat[i].raisedCycle = 0;
+      CPU.intStat[i].waitNs = 0; CPU.intStat[i].maxNs = 0;
+      CPU.intStat[i].waitCycles = 0;
+    }
+    CPU.numCycles = 0;
+    for (i=0; i<tlbSize; i++)
+    { CPU.TLB[i].pid = nullPid; CPU.TLB[i].page = -1; CPU.TLB[i].frame = -1; }
+    CPU.tlbHits = 0;
+    CPU.tlbMisses = 0;
+    CPU.fusedRetired = 0;
+    CPU.stallCycles = 0;
+    for (i=0; i<numOsKinds; i++) CPU.osCycles[i] = 0;
+    CPU.osTime = 0;
+  }
+  bind_core (bootCore);
+}
+
+void bind_core (int core)
+{ thisCore = &cpuCores[core]; }
+
+void checkpoint_cpu ()
+{
+  ckpt_write (cpuCores, numCores*sizeof(typeCPU));
+}
+
+// the timers are restored by clock.c, the TLB starts empty
+void restore_cpu ()
+{ typeCPU *saved;
+  struct eventNode *tree, *head;
+  int k, i;
+
+  saved = (typeCPU *) ckpt_read (numCores*sizeof(typeCPU));
+  for (k=0; k<numCores; k++)
+  { bind_core (k);
+    tree = CPU.eventTree; head = CPU.eventHead;
+    CPU = saved[k];
+    CPU.eventTree = tree; CPU.eventHead = head;
+    if (CPU.Pid >= idlePid && CPU.Pid < maxProcess && PCB[CPU.Pid] != NULL)
+      CPU.PTptr = PCB[CPU.Pid]->PTptr;
+    else CPU.PTptr = NULL;
+    for (i=0; i<tlbSize; i++)
+    { CPU.TLB[i].pid = nullPid; CPU.TLB[i].page = -1; CPU.TLB[i].frame = -1; }
+  }
+  bind_core (bootCore);
 }
 
 void dump_registers (FILE *outf)
 {
+  if (numCores > 1) fprintf (outf, "Core %d: ", CPU.coreId);
   fprintf (outf, "Pid=%d, ", CPU.Pid);
   fprintf (outf, "PC=%d, ", CPU.PC);
   fprintf (outf, "IR=(%d,%d), ", CPU.IRopcode, CPU.IRoperand);
@@ -33,49 +79,171 @@ void dump_registers (FILE *outf)
   fprintf (outf, "cycle=%d\n", CPU.numCycles);
 }
 
+void dump_core_registers (FILE *outf)
+{ typeCPU *self;
+  int k;
+
+  self = thisCore;
+  for (k=0; k<numCores; k++) { bind_core (k); dump_registers (outf); }
+  thisCore = self;
+}
+
+//=========================================================================
+// Interrupt controller of a core
+// A source is latched in interruptV with an atomic or, so the terminal,
+// swap and timer threads can raise it while the core runs, nothing is lost
+// handle_interrupt clears a source before it runs its handler, a raise
+// that comes during the handler stays pending and is dispatched again
+// Sources are dispatched one at a time in priority order, a higher source
+// raised meanwhile goes first; masked sources stay latched until unmasked
+// Each source counts the delay from latching to dispatch, in host time
+// and in cycles of the core (admin command i)
+//=========================================================================
+
+// dispatch order, highest first
+unsigned intPriority[numIntSources] =
+  { pFaultException, endIOinterrupt, ageInterrupt, tqInterrupt };
+char *intName[numIntSources] = { "timeq", "endIO", "agescan", "pfault" };
+  // indexed by bit number
+
+long long host_nsec ()
+{ struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((long long) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+// the raise that turns the bit on stamps the source, the others find it
+// pending. The stamp is written after the bit, the core may serve it with
+// the stamp of the earlier raise, and a disk or terminal raise reads the
+// clock of the core from its own host thread: the wait statistics
+// (account_interrupt) are approximate
 void set_interrupt (unsigned bit)
-{ CPU.interruptV = CPU.interruptV | bit; }
+{ typeIntStat *st;
+
+  if (bit == 0 || bit >= (1 << numIntSources))
+  { fprintf (infF, "Error: illegal interrupt %x\n", bit); return; }
+  st = &CPU.intStat[__builtin_ctz (bit)];
+  if ((__sync_fetch_and_or (&CPU.interruptV, bit) & bit) == 0)
+  { st->raisedAt = host_nsec ();
+    st->raisedCycle = CPU.numCycles;
+    __sync_fetch_and_add (&st->raised, 1);
+  }
+}
 
 void clear_interrupt (unsigned bit)
 { unsigned negbit = -bit - 1;
   if (cpuDebug) fprintf (bugF, "IV is %x, ", CPU.interruptV);
-  CPU.interruptV = CPU.interruptV & negbit;
+  __sync_fetch_and_and (&CPU.interruptV, negbit);
   if (cpuDebug) fprintf (bugF, "after clear is %x\n", CPU.interruptV);
 }
 
+// the page fault exception belongs to the running instruction, no masking
+void mask_interrupt (unsigned bits)
+{ CPU.interruptMask = CPU.interruptMask | (bits & ~pFaultException); }
+
+void unmask_interrupt (unsigned bits)
+{ CPU.interruptMask = CPU.interruptMask & ~bits; }
+
+void account_interrupt (unsigned bit)
+{ typeIntStat *st;
+  long long wait;
+
+  st = &CPU.intStat[__builtin_ctz (bit)];
+  wait = host_nsec () - st->raisedAt;
+  st->served++;
+  st->waitNs = st->waitNs + wait;
+  if (wait > st->maxNs) st->maxNs = wait;
+  st->waitCycles = st->waitCycles + (CPU.numCycles - st->raisedCycle);
+}
+
+// the pending interrupt that comes first in intPriority
+unsigned highest_interrupt (unsigned pending)
+{ int i;
+
+  for (i=0; (pending & intPriority[i]) == 0; i++)
+    ;
+  return (intPriority[i]);
+}
+
 void handle_interrupt ()
-{ if (cpuDebug)
+{ unsigned pending, bit;
+
+  if (cpuDebug)
     fprintf (bugF,
             "Interrupt handler: pid = %d; interrupt = %x; exeStatus = %d\n",
             CPU.Pid, CPU.interruptV, CPU.exeStatus);
-  while (CPU.interruptV != 0)
-  { if ((CPU.interruptV & ageInterrupt) == ageInterrupt)
-    { memory_agescan ();
-      clear_interrupt (ageInterrupt);
-    }
-    if ((CPU.interruptV & pFaultException) == pFaultException)
-    { page_fault_handler ();
-      clear_interrupt (pFaultException);
+  while ((pending = interrupt_pending ()) != 0)
+  { bit = highest_interrupt (pending);
+    clear_interrupt (bit);
+    account_interrupt (bit);
+    charge_os (osInterrupt);
+    if (traceMode) trace_interrupt (bit);
+    switch (bit)
+    { case pFaultException:
+        page_fault_handler (); break;
+      case endIOinterrupt:
+        if (traceMode) trace_take_devices ();   // completions to take in
+        endIO_moveto_ready (); break;
+        // moves all IO done processes (maybe > 1), a completion after
+        // the move raises the interrupt again
+      case ageInterrupt:
+        memory_agescan (); break;
+      case tqInterrupt:
+        if (CPU.exeStatus == eRun) CPU.exeStatus = eReady;
+        break;
     }
-    if ((CPU.interruptV & endIOinterrupt) == endIOinterrupt)
-    { endIO_moveto_ready ();
-      // interrupt may overwrite, move all IO done processes (maybe > 1)
-      clear_interrupt (endIOinterrupt);
-    }
-    if ((CPU.interruptV & tqInterrupt) == tqInterrupt)
-    { if (CPU.exeStatus == eRun) CPU.exeStatus = eReady;
-      clear_interrupt (tqInterrupt);
+  }
+}
+
+void dump_interrupts (FILE *outf)
+{ typeCPU *self;
+  typeIntStat *st;
+  int k, i;
+
+  fprintf (outf, "******************** Interrupt Dump\n");
+  self = thisCore;
+  for (k=0; k<numCores; k++)
+  { bind_core (k);
+    if (numCores > 1) fprintf (outf, "Core %d: ", k);
+    fprintf (outf, "IV=%x, mask=%x\n", CPU.interruptV, CPU.interruptMask);
+    for (i=0; i<numIntSources; i++)
+    { st = &CPU.intStat[i];
+      if (st->served == 0) continue;
+      fprintf (outf, "  %-8s raised=%u, served=%u, ", intName[i],
+               st->raised, st->served);
+      fprintf (outf, "wait avg=%.1fus (%.1f cycles), max=%.1fus\n",
+               st->waitNs/1000.0/st->served,
+               (double) st->waitCycles/st->served, st->maxNs/1000.0);
     }
+    if (CPU.osTime > 0)
+      fprintf (outf, "  OS overhead: switch=%lld, fault=%lld, interrupt=%lld, "
+               "timer=%lld cycles\n", CPU.osCycles[osSwitch],
+               CPU.osCycles[osFault], CPU.osCycles[osInterrupt],
+               CPU.osCycles[osTimer]);
   }
+  thisCore = self;
 }
 
 // fetch one instruction and the corresponding data
 void fetch ()
 { int mret;
+  typeDecoded *di;
 
-  mret = get_instruction (CPU.PC);
+  di = icache_fetch (CPU.Pid, CPU.PC);
+  if (di != NULL)   // predecoded, no address translation and decoding
+  { CPU.IRopcode = di->opcode;
+    CPU.IRoperand = di->operand;
+    mret = mNormal;
+  }
+  else mret = get_instruction (CPU.PC);
   if (mret == mError) CPU.exeStatus = eError;
   else if (mret == mPFault) CPU.exeStatus = ePFault;
+  else if (vector_length (CPU.IRopcode) > 0)
+  { mret = vector_fetch ();
+    if (mret == mError) CPU.exeStatus = eError;
+    else if (mret == mPFault) CPU.exeStatus = ePFault;
+  } // vector instructions get their data page by page when executed
   else // from this point on, it is to fetch data
        // but for OPexit and OPsleep, there is no data => excluded
        // also for OPstore, it stores data, not gets data => excluded
@@ -83,7 +251,7 @@ void fetch ()
         && CPU.IRopcode != OPstore)
     { mret = get_data (CPU.IRoperand);
       if (cpuDebug)
-        printf ("%%%%%%%% Pid, PC, opcode, operand, MBR: %d %d %d %d %.1f\n",
+        printf ("%%%%%%%% Pid, PC, opcode, operand, MBR: %d %d %d %d "mdOutFormat"\n",
                 CPU.Pid, CPU.PC, CPU.IRopcode, CPU.IRoperand, CPU.MBR);
       if (mret == mError) CPU.exeStatus = eError;
       else if (mret == mPFault) CPU.exeStatus = ePFault;
@@ -93,6 +261,9 @@ void fetch ()
         else if (mret == mPFault) CPU.exeStatus = ePFault;
       } // load2 is indirect load, need to use the retrieved data as addr
         // and retrieve data again
+      else if (CPU.IRopcode == OPifgo && di != NULL)
+      { CPU.PC++; CPU.IRoperand = di->target; }
+        // decoded ifgo already has the goto addr of the second word
       else if (CPU.IRopcode == OPifgo)
       { mret = get_instruction (CPU.PC+1);
         if (mret == mError) CPU.exeStatus = eError;
@@ -140,42 +311,316 @@ void execute_instruction ()
       insert_termIO (CPU.Pid, str, regularIO);
       CPU.exeStatus = eWait; break;
     case OPsleep:
+      account_state (CPU.Pid, rsSleep);
       add_timer (CPU.IRoperand, CPU.Pid, actReadyInterrupt, oneTimeTimer);
       CPU.exeStatus = eWait; break;
     case OPexit:
       CPU.exeStatus = eEnd; break;
+    case OPvadd: case OPvmul: case OPvsum: case OPvscale:
+    case OPmemcpy: case OPmemset:
+      vector_execute (); break;
     default:
       fprintf (infF, "Illegitimate OPcode in process %d\n", CPU.Pid);
       CPU.exeStatus = eError;
   }
 }
 
-void cpu_execution ()
-{ int mret;
+// one instruction cycle: fetch and execute, no interrupt and clock handling
+// used by the switch engine and as the slow path of the threaded engine
+void step_instruction ()
+{
+  fetch ();
+  if (cpuDebug) { fprintf (bugF, "Fetched: "); dump_registers (bugF); }
+  if (CPU.exeStatus == eRun)
+  { execute_instruction ();
+    // if it is eError or eEnd, does not matter
+    // if it is page fault, then AC, PC should not be changed
+    // because the instruction should be re-executed
+    // so only execute if it is eRun
+    if (CPU.exeStatus != ePFault) CPU.PC++;
+      // the put_data may change exeStatus, need to check again
+      // if it is ePFault, then data has not been put in memory
+      // => need to set back PC so that instruction will be re-executed
+      // no other instruction will cause problem and execution is done
+    if (cpuDebug) { fprintf (bugF, "Executed: "); dump_registers (bugF); }
+  }
+}
+
+// reference engine: switch dispatch, one instruction per dispatch
+// instructions run in a batch up to the next timer event, the clock is
+// counted on without checking the timers, which are not due before
+// the last cycle of the batch; a pending interrupt ends the batch after
+// the current instruction and is handled before that last cycle, so
+// interrupts and timers come at the same cycle as with per-cycle checks
+void switch_execution ()
+{ int pc, budget, n;
 
   // perform all memory fetches, analyze memory conditions
   while (CPU.exeStatus == eRun)
-  { fetch ();
-    if (cpuDebug) { fprintf (bugF, "Fetched: "); dump_registers (bugF); }
-    if (CPU.exeStatus == eRun)
-    { execute_instruction ();
-      // if it is eError or eEnd, does not matter
-      // if it is page fault, then AC, PC should not be changed
-      // because the instruction should be re-executed
-      // so only execute if it is eRun
-      if (CPU.exeStatus != ePFault) CPU.PC++;
-        // the put_data may change exeStatus, need to check again
-        // if it is ePFault, then data has not been put in memory
-        // => need to set back PC so that instruction will be re-executed
-        // no other instruction will cause problem and execution is done
-      if (cpuDebug) { fprintf (bugF, "Executed: "); dump_registers (bugF); }
+  { budget = cycles_to_next_timer ();
+    if (traceMode == traceReplay) budget = trace_budget (budget);
+    memory_lock_shared ();
+    n = 0;
+    while (1)
+    { pc = CPU.PC;
+      step_instruction ();
+      n++;
+      if (profileOn)
+        profile_instruction (CPU.Pid, pc, CPU.IRopcode, CPU.exeStatus);
+      if (traceMode) trace_retire (pc);
+      if (CPU.stallCycles > 0)   // cache stalls of the instruction
+      { if (stallsToClock)
+        { CPU.numCycles = CPU.numCycles + CPU.stallCycles;
+          n = n + CPU.stallCycles;
+        }
+        CPU.stallCycles = 0;
+      }
+      if (!freeRun && instrTime > 0) usleep (instrTime);
+        // control the speed of execution
+      if (n >= budget || CPU.exeStatus != eRun || batch_break ()) break;
+      CPU.numCycles++;
     }
-
-    if (CPU.interruptV != 0) handle_interrupt ();
-    usleep (instrTime);   // control the speed of execution
+    memory_unlock ();
+    if (traceMode == traceReplay) trace_inject ();
+    if (interrupt_pending ()) handle_interrupt ();
     advance_clock ();
       // since we don't have clock, we use instruction cycle as the clock
       // no matter whether there is a page fault or an error,
       // should handle clock increment and interrupt
   }
 }
+
+//=========================================================================
+// threaded engine: direct-threaded dispatch over the predecoded pages
+// (icache.c), using GCC labels-as-values. Each decoded entry holds the
+// address of its handler, a handler jumps straight to the next handler.
+// Instructions run straight-line until the budget (cycles to the next
+// timer event) is used up or the status is no longer eRun. An interrupt
+// from another thread or a waiting memory lock writer (batch_break)
+// ends the run at the next branch or page change.
+// Anything not decoded, and the rare print/sleep/exit, take the slow path,
+// which is one step_instruction. Hot sequences fused by icache.c run as
+// superinstructions. Each instruction is still one cycle, so
+// timers fire at the same cycle as in the switch engine.
+//=========================================================================
+
+#define threadBatch 256   // max #instructions in one run when the speed
+                          // is controlled by instrTime, so that the
+                          // usleep after the run stays short
+#define numOPcode 10      // opcodes 0 .. OPload2 have a handler slot
+
+// set the exeStatus for an abnormal memory access
+#define memory_exception(mret) \
+  { if ((mret) == mError) CPU.exeStatus = eError; \
+    else CPU.exeStatus = ePFault; }
+
+int run_threaded (int budget)
+{ static void *handlers[numOPcode] =
+    { &&op_slow, &&op_slow, &&op_load, &&op_add, &&op_mul,
+      &&op_ifgo, &&op_store, &&op_slow, &&op_slow, &&op_load2 };
+       // 0 and unknown opcodes, OPexit, OPprint, OPsleep take the slow path
+  static void *fusedHandlers[] =   // indexed by fused, see simos.h
+    { &&op_slow, &&fuse_las, &&fuse_lms, &&fuse_lmas, &&fuse_si };
+  typeICachePage *cpage;
+  typeDecoded *di, *end;
+  int n, base, i, mret;
+
+  n = 0;
+enter:  // (re)locate the decoded page holding PC
+  if (n >= budget || CPU.exeStatus != eRun) return (n);
+  if (n > 0 && batch_break ()) return (n);
+  cpage = icache_page (CPU.Pid, CPU.PC);
+  if (cpage == NULL) goto op_slow;
+  if (!cpage->threaded)  // first time in this page, thread its entries
+  { for (i=0; i<pageSize; i++)
+    { di = &cpage->instr[i];
+      if (di->length == 0 || di->opcode < 0 || di->opcode >= numOPcode)
+        di->handler = &&op_slow;
+      else if (di->fused != fuseNone) di->handler = fusedHandlers[di->fused];
+      else di->handler = handlers[di->opcode];
+    }
+    cpage->threaded = 1;
+  }
+  base = (CPU.PC / pageSize) * pageSize;
+  di = &cpage->instr[CPU.PC - base];
+  end = &cpage->instr[pageSize];
+  if (cpuEngine == jitEngine)   // blocks start here, hot ones run native
+  { i = jit_execute (cpage, di, CPU.PC, budget - n);
+    if (i > 0) { n += i; goto enter; }
+  }
+  goto *di->handler;
+
+// next instruction is len words further, stay in the page if possible
+#define dispatch_next(len) \
+  { CPU.PC += (len); n++; \
+    if (n >= budget) return (n); \
+    di += (len); \
+    if (di >= end) goto enter; \
+    goto *di->handler; }
+
+op_load:
+  mret = get_data (di->operand);
+  if (mret != mNormal) goto fault;
+  CPU.AC = CPU.MBR;
+  dispatch_next (1);
+
+op_load2:  // indirect load, the retrieved data is the address
+  mret = get_data (di->operand);
+  if (mret == mNormal) mret = get_data (CPU.MBR);
+  if (mret != mNormal) goto fault;
+  CPU.AC = CPU.MBR;
+  dispatch_next (1);
+
+op_add:
+  mret = get_data (di->operand);
+  if (mret != mNormal) goto fault;
+  CPU.AC = CPU.AC + CPU.MBR;
+  dispatch_next (1);
+
+op_mul:
+  mret = get_data (di->operand);
+  if (mret != mNormal) goto fault;
+  CPU.AC = CPU.AC * CPU.MBR;
+  dispatch_next (1);
+
+op_ifgo:  // joined two-word ifgo, goto addr is in target
+  mret = get_data (di->operand);
+  if (mret != mNormal) goto fault;
+  if (CPU.MBR > 0)
+  { CPU.PC = di->target; n++;
+    goto enter;
+  }
+  dispatch_next (2);
+
+op_store:
+  CPU.MBR = CPU.AC;
+  mret = put_data (di->operand);
+  if (mret == mPFault) goto fault;
+  if (mret == mError)  // same as switch engine, PC moves on after error
+  { CPU.exeStatus = eError; CPU.PC++; n++;
+    return (n);
+  }
+  if (!cpage->valid)  // stored into this code page, or the frame is gone
+  { CPU.PC++; n++; goto enter; }
+  dispatch_next (1);
+
+// superinstructions: each part is one cycle and may fault by itself,
+// PC is then left at that part, so it is re-executed as in the switch engine
+// a superinstruction only runs if all of its parts fit in the budget
+#define fused_fits \
+  if (n + di->fuseLen > budget) goto *handlers[di->opcode]
+
+#define part_data(d, expr) \
+  { mret = get_data ((d)->operand); \
+    if (mret != mNormal) { di = (d); goto fault; } \
+    CPU.AC = (expr); CPU.PC++; n++; }
+
+#define part_store(d) \
+  { CPU.MBR = CPU.AC; \
+    mret = put_data ((d)->operand); \
+    if (mret == mPFault) { di = (d); goto fault; } \
+    CPU.PC++; n++; \
+    if (mret == mError) { CPU.exeStatus = eError; return (n); } }
+
+// PC has been advanced by the parts, a store part may have invalidated
+// the page (see threaded_execution)
+#define fused_next(len) \
+  { if (n >= budget) return (n); \
+    if (!cpage->valid) goto enter; \
+    di += (len); \
+    if (di >= end) goto enter; \
+    goto *di->handler; }
+
+fuse_las:
+  fused_fits;
+  part_data (di, CPU.MBR);
+  part_data (di+1, CPU.AC + CPU.MBR);
+  part_store (di+2);
+  CPU.fusedRetired += 3;
+  fused_next (3);
+
+fuse_lms:
+  fused_fits;
+  part_data (di, CPU.MBR);
+  part_data (di+1, CPU.AC * CPU.MBR);
+  part_store (di+2);
+  CPU.fusedRetired += 3;
+  fused_next (3);
+
+fuse_lmas:
+  fused_fits;
+  part_data (di, CPU.MBR);
+  part_data (di+1, CPU.AC * CPU.MBR);
+  part_data (di+2, CPU.AC + CPU.MBR);
+  part_store (di+3);
+  CPU.fusedRetired += 4;
+  fused_next (4);
+
+fuse_si:  // store, then the joined two-word ifgo
+  fused_fits;
+  part_store (di);
+  if (!cpage->valid) goto enter;   // the ifgo may have been overwritten
+  mret = get_data ((di+1)->operand);
+  if (mret != mNormal) { di = di+1; goto fault; }
+  n++;
+  CPU.fusedRetired += 2;
+  if (CPU.MBR > 0)
+  { CPU.PC = (di+1)->target;
+    goto enter;
+  }
+  CPU.PC += 2;
+  fused_next (3);
+
+op_slow:  // not decoded or rare instruction, run one reference cycle
+  // the clock does not show the n instructions of the batch yet, while
+  // print and sleep set their timers relative to it; no timer is due
+  // within the budget, so it is brought up to date without check_timer
+  CPU.numCycles += n;
+  step_instruction ();
+  CPU.numCycles -= n;   // threaded_execution adds the whole batch
+  n++;
+  goto enter;
+
+fault:  // PC is not advanced, the instruction will be re-executed
+  CPU.IRopcode = di->opcode;
+  CPU.IRoperand = di->operand;
+  memory_exception (mret);
+  n++;
+  return (n);
+}
+
+void threaded_execution ()
+{ int budget, n;
+
+  while (CPU.exeStatus == eRun)
+  { budget = cycles_to_next_timer ();
+    if (!freeRun && instrTime > 0 && budget > threadBatch)
+      budget = threadBatch;
+    if (interrupt_pending ()) budget = 1;
+      // a pending interrupt is handled after the next instruction,
+      // same as in the switch engine
+    memory_lock_shared ();
+      // a store to an unallocated page trades this lock for the exclusive
+      // one to get a frame, which may evict a page (calculate_memory_address):
+      // after every store the run re-checks cpage->valid before it goes on
+      // in the decoded page (op_store, fused_next, fuse_si)
+    n = run_threaded (budget);
+    memory_unlock ();
+    PCB[CPU.Pid]->numInstr += n;
+    PCB[CPU.Pid]->numFused += CPU.fusedRetired;
+    CPU.fusedRetired = 0;
+    if (interrupt_pending ()) handle_interrupt ();
+    if (!freeRun && instrTime > 0) usleep (instrTime*n);   // control the speed of execution
+    advance_clock_by (n);
+  }
+}
+
+void cpu_execution ()
+{
+  if ((cpuEngine == threadedEngine || cpuEngine == jitEngine)
+      && !cpuDebug && !profileOn && !traceMode && !cacheModel)
+    threaded_execution ();
+  else switch_execution ();
+    // the switch engine is the reference, also used for debug tracing,
+    // profiling, the instruction trace and the cache model
+}
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "simos.h"
+
+//=========================================================================
+// Predecoded instruction cache
+// Each code page of a process is decoded once, when the page is brought
+//    into memory (swap.c for swapped-in pages, loader.c for the idle process)
+// The decoded form keeps opcode/operand pairs, and a two-word OPifgo is
+//    joined into one entry (goto address kept in target)
+// cpu.c fetches from the decoded page instead of going through
+//    get_instruction -> calculate_memory_address -> Memory -> shift/mask
+// A decoded page is invalidated when
+//    (1) a store hits the page (memory.c)
+//    (2) the frame is evicted, freed or remapped (paging.c)
+//=========================================================================
+
+// the opcodes, opcodeShift and operandMask are in simos.h
+
+typeICachePage **icacheTable;
+  // one slot for each (pid, page), slot = pid*maxPpages + page
+  // a slot is allocated when the page is first decoded and then reused
+
+void initialize_icache ()
+{ int i;
+
+  icacheTable = (typeICachePage **)
+                malloc (maxProcess*maxPpages*sizeof(typeICachePage *));
+  for (i=0; i<maxProcess*maxPpages; i++) icacheTable[i] = NULL;
+}
+
+typeICachePage *get_icache_slot (int pid, int page)
+{ typeICachePage *cpage;
+  int i;
+
+  cpage = icacheTable[pid*maxPpages+page];
+  if (cpage == NULL)
+  { cpage = (typeICachePage *) malloc (sizeof(typeICachePage));
+    cpage->instr = (typeDecoded *) malloc (pageSize*sizeof(typeDecoded));
+    cpage->valid = 0;
+    cpage->threaded = 0;
+    cpage->frame = nullPid;
+    for (i=0; i<pageSize; i++)
+    { cpage->instr[i].length = 0; cpage->instr[i].fused = fuseNone;
+      cpage->instr[i].jit = NULL;
+    }
+    icacheTable[pid*maxPpages+page] = cpage;
+  }
+  return (cpage);
+}
+
+// superinstruction patterns, opcodes of the fused instructions in order
+// the last instruction of fuseSI is the two-word ifgo
+typedef struct
+{ int fused, len;
+  int opcode[4];
+} FusePattern;
+
+FusePattern fusePatterns[] =   // longer patterns first
+{ { fuseLMAS, 4, { OPload, OPmul, OPadd, OPstore } },
+  { fuseLAS, 3, { OPload, OPadd, OPstore } },
+  { fuseLMS, 3, { OPload, OPmul, OPstore } },
+  { fuseSI, 2, { OPstore, OPifgo } }
+};
+#define numPatterns 4
+
+// does pattern p start at word i of the decoded page
+int match_pattern (typeDecoded *instr, int i, int ncode, FusePattern *p)
+{ int k, w;
+
+  w = i;
+  for (k=0; k<p->len; k++)
+  { if (w >= ncode || instr[w].length == 0) return (0);
+    if (instr[w].opcode != p->opcode[k]) return (0);
+    w = w + instr[w].length;
+  }
+  return (1);
+}
+
+// fusion pass, every word gets the longest superinstruction starting
+// there (a goto may land in the middle of another one)
+// numCode and numFused are counted along a greedy, non-overlapping walk
+void fuse_page (typeICachePage *cpage, int ncode)
+{ typeDecoded *di;
+  int i, j, k;
+
+  for (i=0; i<ncode; i++)
+  { di = &cpage->instr[i];
+    di->fused = fuseNone;
+    di->fuseLen = 1;
+    for (j=0; j<numPatterns; j++)
+      if (match_pattern (cpage->instr, i, ncode, &fusePatterns[j]))
+      { di->fused = fusePatterns[j].fused;
+        di->fuseLen = fusePatterns[j].len;
+        break;
+      }
+  }
+  cpage->numCode = 0;
+  cpage->numFused = 0;
+  i = 0;
+  while (i < ncode)
+  { di = &cpage->instr[i];
+    cpage->numCode = cpage->numCode + di->fuseLen;
+    if (di->fused != fuseNone)
+    { cpage->numFused = cpage->numFused + di->fuseLen;
+      for (k=0; k<di->fuseLen; k++) i = i + cpage->instr[i].length;
+    }
+    else if (di->length > 0) i = i + di->length;
+    else i++;
+  }
+}
+
+// decode the code words of page (now in frame) of process pid
+// words at or beyond dataOffset are data, they keep length 0
+void icache_load_page (int pid, int page, int frame)
+{ typeICachePage *cpage;
+  typeDecoded *di;
+  int i, addr, ncode;
+  mwordType instr;
+
+  if (pid < 0 || pid >= maxProcess || page < 0 || page >= maxPpages) return;
+  if (PCB[pid] == NULL || page*pageSize >= PCB[pid]->dataOffset) return;
+    // data page, nothing to decode
+
+  cpage = get_icache_slot (pid, page);
+  cpage->valid = 0;
+  ncode = PCB[pid]->dataOffset - page*pageSize;
+  if (ncode > pageSize) ncode = pageSize;
+  for (i=0; i<pageSize; i++)
+  { di = &cpage->instr[i];
+    di->fused = fuseNone;
+    di->hotness = 0;
+    di->jit = NULL;
+    if (i >= ncode) { di->length = 0; continue; }
+    addr = frame*pageSize + i;
+    instr = Memory[addr].mInstr;
+    di->opcode = instr >> opcodeShift;
+    di->operand = instr & operandMask;
+    di->target = 0;
+    di->length = 1;
+    if (di->opcode == OPifgo)
+    { // join the second word, only if it is on the same page
+      if (i+1 < ncode)
+      { di->target = Memory[addr+1].mInstr & operandMask;
+        di->length = 2;
+      }
+      else di->length = 0;  // second word on the next page, use slow path
+    }
+  }
+  fuse_page (cpage, ncode);
+  cpage->frame = frame;
+  cpage->threaded = 0;
+  cpage->valid = 1;
+  if (cpuDebug)
+    fprintf (bugF, "Icache: decoded pid=%d, page=%d, frame=%d, #instr=%d\n",
+             pid, page, frame, ncode);
+}
+
+void icache_invalidate_page (int pid, int page)
+{ typeICachePage *cpage;
+
+  if (pid < 0 || pid >= maxProcess || page < 0 || page >= maxPpages) return;
+  cpage = icacheTable[pid*maxPpages+page];
+  if (cpage != NULL && cpage->valid)
+  { cpage->valid = 0;
+    if (cpuDebug)
+      fprintf (bugF, "Icache: invalidated pid=%d, page=%d\n", pid, page);
+  }
+}
+
+// page table entry of (pid, page) has changed, keep the decoded page
+// only if it still refers to the frame it was decoded from
+void icache_remap_page (int pid, int page, int frame)
+{ typeICachePage *cpage;
+
+  if (pid < 0 || pid >= maxProcess || page < 0 || page >= maxPpages) return;
+  cpage = icacheTable[pid*maxPpages+page];
+  if (cpage != NULL && cpage->valid && cpage->frame != frame)
+    icache_invalidate_page (pid, page);
+}
+
+void icache_free_process (int pid)
+{ int page;
+  typeICachePage *cpage;
+
+  for (page=0; page<maxPpages; page++)
+  { cpage = icacheTable[pid*maxPpages+page];
+    if (cpage != NULL)
+    { free (cpage->instr); free (cpage);
+      icacheTable[pid*maxPpages+page] = NULL;
+    }
+  }
+}
+
+// return the decoded instruction at offset for process pid,
+// or NULL if it is not cached (caller should use get_instruction)
+// a hit still references the frame, same as calculate_memory_address
+typeDecoded *icache_fetch (int pid, int offset)
+{ typeICachePage *cpage;
+  typeDecoded *di;
+  int page;
+
+  if (offset < 0) return (NULL);
+  page = offset / pageSize;
+  if (page >= maxPpages) return (NULL);
+  cpage = icacheTable[pid*maxPpages+page];
+  if (cpage == NULL || !cpage->valid) return (NULL);
+  di = &cpage->instr[offset - page*pageSize];
+  if (di->length == 0) return (NULL);
+  reference_frame (cpage->frame);
+  return (di);
+}
+
+// return the decoded page holding offset for process pid, or NULL
+// used by the threaded engine, which walks the entries of the page
+typeICachePage *icache_page (int pid, int offset)
+{ typeICachePage *cpage;
+  int page;
+
+  if (offset < 0) return (NULL);
+  page = offset / pageSize;
+  if (page >= maxPpages) return (NULL);
+  cpage = icacheTable[pid*maxPpages+page];
+  if (cpage == NULL || !cpage->valid) return (NULL);
+  reference_frame (cpage->frame);
+    // no age scan can run while the engine stays in the page
+  return (cpage);
+}
+
+// static coverage: decoded code of the process covered by superinstructions
+// dynamic coverage: retired instructions that ran as part of one
+void dump_fusion (FILE *outf, int pid)
+{ typeICachePage *cpage;
+  int page, ncode, nfused;
+
+  ncode = 0; nfused = 0;
+  for (page=0; page<maxPpages; page++)
+  { cpage = icacheTable[pid*maxPpages+page];
+    if (cpage == NULL || !cpage->valid) continue;
+    ncode = ncode + cpage->numCode;
+    nfused = nfused + cpage->numFused;
+  }
+  fprintf (outf, "Process %d fusion: static %d/%d instr (%.1f%%), ",
+           pid, nfused, ncode, (ncode == 0) ? 0.0 : 100.0*nfused/ncode);
+  fprintf (outf, "dynamic %d/%d instr (%.1f%%)\n",
+           PCB[pid]->numFused, PCB[pid]->numInstr,
+           (PCB[pid]->numInstr == 0) ? 0.0
+             : 100.0*PCB[pid]->numFused/PCB[pid]->numInstr);
+}
@@ -31,6 +31,7 @@ void init_idle_process ()
   PCB[idlePid]->Pid = idlePid;  // idlePid = 1, set in ???
   PCB[idlePid]->PC = 0;
   PCB[idlePid]->AC = 0;
+  PCB[idlePid]->osTime = 0;
   load_idle_process ();
   if (cpuDebug)
     { dump_PCB (bugF, idlePid);
@@ -48,8 +49,9 @@ void execute_idle_process ()
 
   int i;
   for (i=0; i<idleQuantum; i++)
-  { if (CPU.interruptV != 0) handle_interrupt ();
-    usleep (instrTime);
+  { if (traceMode == traceReplay) trace_inject ();
+    if (interrupt_pending ()) handle_interrupt ();
+    if (!freeRun) usleep (instrTime);
     advance_clock ();
   }
 }
@@ -0,0 +1,327 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "simos.h"
+
+//=========================================================================
+// Basic-block JIT, the top tier of the jit engine (cpuEngine = jitEngine)
+// The threaded engine (cpu.c) counts how often a decoded entry starts a
+// block. Once it reaches jitThreshold, the block is compiled to x86-64
+// code in an mmap'd executable buffer.
+//
+// A block starts at a decoded entry and runs straight-line within the page
+//    body:       OPload, OPadd, OPmul, OPstore
+//    terminator: OPifgo (joined) or OPload2, included in the block
+//    it stops before anything else (print, sleep, exit, undecoded words)
+// Before the native code runs, every direct data address of the block is
+// translated once (jit_resolve). If any page is not resident, or a store
+// would hit a code page, the block is left to the interpreter, which then
+// takes the page fault at exactly the right instruction.
+// Only the indirect access of an OPload2 terminator is translated at run
+// time. It may fault, but it is the last instruction, so PC stays on it.
+// A block is only entered if all its cycles fit before the next timer, so
+// timers and interrupts are still taken in the interpreter.
+// Code is generated on x86-64 hosts for float and double mdType (scalar
+// SSE). On other hosts, for the integer types, and with more than one core
+// (the code addresses the registers of core 0), initialize_jit falls back
+// to the threaded engine.
+//=========================================================================
+
+#define jitCodeSize (1024*1024)   // size of the executable buffer
+#define maxJitBlocks 4096
+#define maxBlockLen 64            // max #instructions in a block
+#define noJit -1                  // hotness of an entry that cannot compile
+
+typedef void (*jitCode) (mType **addr);
+
+typedef struct
+{ typeDecoded *owner;   // entry the block starts at
+  int epoch;            // jitEpoch when compiled, stale after a flush
+  int len;              // #instructions = #cycles
+  int numAddr;          // #direct data addresses
+  int operand[maxBlockLen];
+  int flag[maxBlockLen];      // flagRead or flagWrite
+  int frame[maxBlockLen];     // frames of the last translation
+  mType *addr[maxBlockLen];   // host addresses of the last translation
+  int mapPid, mapEpoch;       // translation is valid for this pid/epoch
+  jitCode code;
+} JitBlock;
+
+// scalar SSE forms: ss for float, sd (prefix F2, compare/clear with 66)
+// for double
+#if !defined(__x86_64__)   // the code generator only emits x86-64
+#define mdPrefix 0xF3
+#define emit_pd_prefix()
+#elif defined(mdFloat)
+#define jitCodegen
+#define mdPrefix 0xF3
+#define emit_pd_prefix()
+#elif defined(mdDouble)
+#define jitCodegen
+#define mdPrefix 0xF2
+#define emit_pd_prefix() emit1 (0x66)
+#else   // integer mdType: jitBuf stays NULL, nothing is emitted
+#define mdPrefix 0xF3
+#define emit_pd_prefix()
+#endif
+
+unsigned char *jitBuf = NULL;
+int jitUsed;
+JitBlock *jitBlocks;
+int numJitBlocks;
+int jitEpoch = 0;
+int jitCompiled = 0, jitRuns = 0, jitBailouts = 0;
+
+void initialize_jit ()
+{
+#ifndef jitCodegen
+  fprintf (infF, "JIT: no code generation for this host or data type, ");
+  fprintf (infF, "threaded engine\n");
+  cpuEngine = threadedEngine;
+  return;
+#endif
+  if (numCores > 1)   // code has the register addresses of one core
+  { fprintf (infF, "JIT: runs on a single core only, threaded engine\n");
+    cpuEngine = threadedEngine;
+    return;
+  }
+  jitBuf = (unsigned char *) mmap (NULL, jitCodeSize,
+                    PROT_READ | PROT_WRITE | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (jitBuf == MAP_FAILED)
+  { fprintf (infF, "JIT: cannot map executable memory, threaded engine\n");
+    cpuEngine = threadedEngine;
+    jitBuf = NULL;
+    return;
+  }
+  jitBlocks = (JitBlock *) malloc (maxJitBlocks*sizeof(JitBlock));
+  jitUsed = 0;
+  numJitBlocks = 0;
+}
+
+// drop all compiled code, entries see a stale epoch and recompile
+void jit_flush ()
+{
+  jitEpoch++;
+  jitUsed = 0;
+  numJitBlocks = 0;
+  if (cpuDebug) fprintf (bugF, "JIT: code buffer flushed\n");
+}
+
+#ifdef jitCodegen
+
+//=====================================
+// x86-64 code emission
+//   rbx: table of host addresses (addr), xmm0: AC, xmm1: MBR
+//=====================================
+
+unsigned char *emitP;
+
+void emit1 (int b) { *emitP++ = (unsigned char) b; }
+
+void emit4 (int v) { memcpy (emitP, &v, 4); emitP += 4; }
+
+void emit8 (void *p) { memcpy (emitP, &p, 8); emitP += 8; }
+
+void emit_mov_rax_imm (void *p)   // mov rax, imm64
+{ emit1 (0x48); emit1 (0xB8); emit8 (p); }
+
+void emit_mov_rdx_imm (void *p)   // mov rdx, imm64
+{ emit1 (0x48); emit1 (0xBA); emit8 (p); }
+
+void emit_mov_rax_addr (int k)   // mov rax, [rbx + 8k]
+{ emit1 (0x48); emit1 (0x8B); emit1 (0x83); emit4 (8*k); }
+
+// scalar mdType operations, modrm selects xmm registers / [rax]
+void emit_md (int op, int modrm)
+{ emit1 (mdPrefix); emit1 (0x0F); emit1 (op); emit1 (modrm); }
+#define mdLoad 0x10    // movss/movsd xmm, m/xmm
+#define mdStore 0x11   // movss/movsd m, xmm
+#define mdAdd 0x58     // addss/addsd
+#define mdMul 0x59     // mulss/mulsd
+#define xmm0_rax 0x00
+#define xmm1_rax 0x08
+#define xmm0_xmm1 0xC1
+#define xmm1_xmm0 0xC8
+
+void emit_store_registers ()   // CPU.AC = xmm0, CPU.MBR = xmm1
+{ emit_mov_rax_imm (&CPU.AC); emit_md (mdStore, xmm0_rax);
+  emit_mov_rax_imm (&CPU.MBR); emit_md (mdStore, xmm1_rax);
+}
+
+void emit_set_int (int *p, int v)   // mov dword [p], v
+{ emit_mov_rdx_imm (p); emit1 (0xC7); emit1 (0x02); emit4 (v); }
+
+// indirect part of a load2 terminator, called from the compiled code
+// CPU.MBR holds the address, PC is on the load2
+void jit_indirect_load ()
+{ int mret;
+
+  mret = get_data (CPU.MBR);
+  if (mret == mNormal) { CPU.AC = CPU.MBR; CPU.PC++; }
+  else if (mret == mError) CPU.exeStatus = eError;
+  else CPU.exeStatus = ePFault;
+}
+
+// compile the block starting at entry di (at offset pc) of page cpage
+JitBlock *jit_compile (typeICachePage *cpage, typeDecoded *di, int pc)
+{ JitBlock *blk;
+  typeDecoded *end;
+  int k, len, term, next;
+
+  if (jitBuf == NULL) return (NULL);
+  if (numJitBlocks == maxJitBlocks || jitUsed + 64*maxBlockLen > jitCodeSize)
+    jit_flush ();
+  blk = &jitBlocks[numJitBlocks];
+  end = &cpage->instr[pageSize];
+
+  // find the extent of the block
+  len = 0; term = 0; next = pc;
+  while (di+len < end && len < maxBlockLen && !term)
+  { switch (di[len].length > 0 ? di[len].opcode : 0)
+    { case OPload: case OPadd: case OPmul: case OPstore:
+        blk->flag[len] = (di[len].opcode == OPstore) ? flagWrite : flagRead;
+        next = next + 1;
+        break;
+      case OPifgo: case OPload2:
+        blk->flag[len] = flagRead;
+        term = di[len].opcode;
+        break;
+      default:
+        goto extent_done;
+    }
+    blk->operand[len] = di[len].operand;
+    len++;
+  }
+extent_done:
+  if (len == 0) return (NULL);
+  blk->len = len;
+  blk->numAddr = len;   // every instruction has one direct address
+  blk->owner = di;
+  blk->epoch = jitEpoch;
+  blk->mapPid = nullPid;
+
+  emitP = jitBuf + jitUsed;
+  blk->code = (jitCode) emitP;
+  emit1 (0x53);                           // push rbx
+  emit1 (0x48); emit1 (0x89); emit1 (0xFB);   // mov rbx, rdi
+  emit_mov_rax_imm (&CPU.AC); emit_md (mdLoad, xmm0_rax);
+  emit_mov_rax_imm (&CPU.MBR); emit_md (mdLoad, xmm1_rax);
+
+  for (k=0; k<len; k++)
+  { emit_mov_rax_addr (k);
+    switch (di[k].opcode)
+    { case OPload:   // MBR = M; AC = MBR
+        emit_md (mdLoad, xmm1_rax); emit_md (mdLoad, xmm0_xmm1); break;
+      case OPadd:
+        emit_md (mdLoad, xmm1_rax); emit_md (mdAdd, xmm0_xmm1); break;
+      case OPmul:
+        emit_md (mdLoad, xmm1_rax); emit_md (mdMul, xmm0_xmm1); break;
+      case OPstore:  // MBR = AC; M = MBR
+        emit_md (mdLoad, xmm1_xmm0); emit_md (mdStore, xmm0_rax); break;
+      case OPifgo:   // MBR = test; PC = (MBR > 0) ? target : next
+        emit_md (mdLoad, xmm1_rax);
+        emit_store_registers ();
+        emit_pd_prefix ();
+        emit1 (0x0F); emit1 (0x57); emit1 (0xD2);   // xorps xmm2, xmm2
+        emit_pd_prefix ();
+        emit1 (0x0F); emit1 (0x2E); emit1 (0xCA);   // ucomiss xmm1, xmm2
+        emit1 (0xB8); emit4 (next + 2);             // mov eax, next
+        emit1 (0xB9); emit4 (di[k].target);         // mov ecx, target
+        emit1 (0x0F); emit1 (0x47); emit1 (0xC1);   // cmova eax, ecx
+        emit_mov_rdx_imm (&CPU.PC);
+        emit1 (0x89); emit1 (0x02);                 // mov [rdx], eax
+        break;
+      case OPload2:  // MBR = M, then the indirect load in C
+        emit_md (mdLoad, xmm1_rax);
+        emit_store_registers ();
+        emit_set_int (&CPU.PC, next);
+        emit_set_int (&CPU.IRopcode, OPload2);
+        emit_set_int (&CPU.IRoperand, di[k].operand);
+        emit_mov_rax_imm ((void *) jit_indirect_load);
+        emit1 (0xFF); emit1 (0xD0);                 // call rax
+        break;
+    }
+  }
+  if (term == 0)
+  { emit_store_registers ();
+    emit_set_int (&CPU.PC, next);
+  }
+  emit1 (0x5B);   // pop rbx
+  emit1 (0xC3);   // ret
+
+  jitUsed = emitP - jitBuf;
+  numJitBlocks++;
+  jitCompiled++;
+  if (cpuDebug)
+    fprintf (bugF, "JIT: compiled pid=%d, pc=%d, len=%d, %d bytes\n",
+             CPU.Pid, pc, len, (int) (emitP - (unsigned char *) blk->code));
+  return (blk);
+}
+
+#else   // no code generator, every entry stays with the interpreter
+
+JitBlock *jit_compile (typeICachePage *cpage, typeDecoded *di, int pc)
+{ return (NULL); }
+
+#endif
+
+// translate the direct addresses of the block for the running process
+// no side effect unless every page is resident and no store hits code
+int jit_resolve (JitBlock *blk)
+{ int k, page, maddr;
+
+  if (blk->mapPid == CPU.Pid && blk->mapEpoch == mapEpoch)
+  { // translations unchanged, only do the access bookkeeping
+    for (k=0; k<blk->numAddr; k++)
+    { reference_frame (blk->frame[k]);
+      if (blk->flag[k] == flagWrite) dirty_frame (blk->frame[k]);
+    }
+    return (1);
+  }
+  for (k=0; k<blk->numAddr; k++)
+  { page = blk->operand[k] / pageSize;
+    if (page >= maxPpages || CPU.PTptr[page] < 0) return (0);
+    if (blk->flag[k] == flagWrite && blk->operand[k] < PCB[CPU.Pid]->dataOffset)
+      return (0);
+  }
+  for (k=0; k<blk->numAddr; k++)
+  { maddr = calculate_memory_address (blk->operand[k], blk->flag[k]);
+    blk->addr[k] = &Memory[maddr];
+    blk->frame[k] = maddr / pageSize;
+  }
+  blk->mapPid = CPU.Pid;
+  blk->mapEpoch = mapEpoch;
+  return (1);
+}
+
+// called by the threaded engine when it enters a block at entry di
+// returns #cycles run in native code, 0 if the interpreter has to run it
+int jit_execute (typeICachePage *cpage, typeDecoded *di, int pc, int budget)
+{ JitBlock *blk;
+
+  blk = (JitBlock *) di->jit;
+  if (blk == NULL || blk->epoch != jitEpoch || blk->owner != di)
+  { if (di->hotness == noJit) return (0);
+    di->hotness++;
+    if (di->hotness < jitThreshold) return (0);
+    blk = jit_compile (cpage, di, pc);
+    di->jit = blk;
+    if (blk == NULL) { di->hotness = noJit; return (0); }
+  }
+  if (blk->len > budget || !jit_resolve (blk))
+  { jitBailouts++; return (0); }
+  blk->code (blk->addr);
+  jitRuns++;
+  return (blk->len);
+}
+
+void dump_jit (FILE *outf)
+{
+  fprintf (outf, "******************** JIT Dump\n");
+  fprintf (outf, "blocks compiled=%d, live=%d, code=%d bytes, ",
+           jitCompiled, numJitBlocks, jitUsed);
+  fprintf (outf, "native runs=%d, bailouts=%d\n", jitRuns, jitBailouts);
+}
@@ -8,12 +8,8 @@
 
 // #define progError -1 in simos.h
 
-// definitions included from paging.c
-#define opcodeShift 24
-#define operandMask 0x00ffffff
+// definitions included from paging.c, opcodeShift/operandMask in simos.h
 #define diskPage -2
-// from cpu.c
-#define OPifgo 5
 
 FILE *fPtr;
 
@@ -59,6 +55,7 @@ int load_process (int pid, char *fname) // Rachana Gupta
   rPages = load_process_to_swap(pid, fname);
   int j = 0;
   while (j < rPages) {
+    count_page_change(pid, PCB[pid]->PTptr[j], diskPage);
     PCB[pid]->PTptr[j] = diskPage;
     j++;
   }
@@ -76,7 +73,7 @@ void load_idle_process () // Rachana Gupta
 
   int page;
   int frame;
-  int instruct;
+  mwordType instruct;
   int operand;
   int data;
   int opcode;
@@ -92,11 +89,12 @@ void load_idle_process () // Rachana Gupta
   //load data for idle process
   opcode = OPifgo;
   operand = 0;
-  instruct = (opcode << opcodeShift) | operand;
+  instruct = ((mwordType) opcode << opcodeShift) | operand;
   direct_put_instruction (frame, 0, instruct);
   direct_put_instruction (frame, 1, instruct);
   direct_put_data (frame, 2, 1);
   PCB[idlePid]->dataOffset=2;
+  icache_load_page (idlePid, page, frame);
 } // end laod idie process
 
 //-------------------------------------------------------------------------------//
@@ -156,7 +154,7 @@ int load_process_to_swap (int pid, char *fname) // Rachana Gupta
   //mType *buf2 = (mType *) malloc (pageSize*sizeof(mType));
   int frame;
   int tInstr, tOpcode, tOperand;
-  unsigned *temp = (unsigned *) malloc (pageSize*sizeof(unsigned));
+  mwordType *temp = (mwordType *) malloc (pageSize*sizeof(mwordType));
 
 
   init_process_pagetable(pid);
@@ -195,14 +193,11 @@ int load_process_to_swap (int pid, char *fname) // Rachana Gupta
   {
     fscanf (fPtr, "%d %d\n", &opcode, &operand);
 
-	opcode = opcode << opcodeShift;
-  operand = operand & operandMask;
-
-
   // and load data into the buffer
-	buf[offset].mInstr = opcode | operand;
+	buf[offset].mInstr = ((mwordType) opcode << opcodeShift)
+	                     | (operand & operandMask);
 
-	temp[offset] = (unsigned)buf[offset].mInstr;
+	temp[offset] = buf[offset].mInstr;
 
 	offset++;
 
@@ -247,9 +242,9 @@ int load_process_to_swap (int pid, char *fname) // Rachana Gupta
 // loop throught the number of data
   for (i=0; i<numdata; i++)
   {
-    fscanf (fPtr, "%f\n", &buf[offset].mData);
+    fscanf (fPtr, mdInFormat"\n", &buf[offset].mData);
 
-	temp[offset] = (unsigned)buf[offset].mInstr;
+	temp[offset] = buf[offset].mInstr;
 	offset++;
 	if (offset==pageSize)
   {
@@ -278,7 +273,7 @@ int load_process_to_swap (int pid, char *fname) // Rachana Gupta
 int load_pages_to_memory (int pid, int numpage) // Rachana Gupta
 {
   // swap.c puts the process in ready queue waiting after the last write
-  unsigned *temp = (unsigned *) malloc (pageSize*sizeof(unsigned));
+  mwordType *temp = (mwordType *) malloc (pageSize*sizeof(mwordType));
   int i;
 
   int *frameNum = (int *) malloc (numpage*sizeof(int));
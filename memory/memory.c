@@ -9,22 +9,18 @@
 // This is the function used by every operation here, but since it
 // depends on the memory management mechanism, it is implemented outside
 
-// rwflag: whehter the addr computation should be for read or for write
-// also defined in paging.c
-#define flagRead 1
-#define flagWrite 2
-
-// define shifts and masks for instruction and memory address
-#define opcodeShift 24
-#define operandMask 0x00ffffff
+// shifts and masks for instruction and memory address are in simos.h
+// (opcodeShift, operandMask), they depend on the word format
 
 int get_data (int offset)
 { int maddr;
 
   maddr = calculate_memory_address (offset, flagRead);
+  if (traceMode) trace_access (offset, flagRead);
   if (maddr == mError || maddr == mPFault) return (maddr);
   else
-  { CPU.MBR = Memory[maddr].mData;
+  { if (cacheModel) cache_access (maddr, flagRead);
+    CPU.MBR = Memory[maddr].mData;
     return (mNormal);
   }
 }
@@ -33,20 +29,27 @@ int put_data (int offset)
 { int maddr;
 
   maddr = calculate_memory_address (offset, flagWrite);
+  if (traceMode) trace_access (offset, flagWrite);
   if (maddr == mError || maddr == mPFault) return (maddr);
   else
-  { Memory[maddr].mData = CPU.MBR;
+  { if (cacheModel) cache_access (maddr, flagWrite);
+    Memory[maddr].mData = CPU.MBR;
+    if (offset < PCB[CPU.Pid]->dataOffset)
+      icache_invalidate_page (CPU.Pid, offset/pageSize);
+      // store into a code page, decoded copy is stale
     return (mNormal);
   }
 }
 
 int get_instruction (int offset)
-{ int maddr, instr;
+{ int maddr;
+  mwordType instr;
 
   maddr = calculate_memory_address (offset, flagRead);
   if (maddr == mError || maddr == mPFault) return (maddr);
   else
-  { instr = Memory[maddr].mInstr;
+  { if (cacheModel) cache_access (maddr, flagRead);
+    instr = Memory[maddr].mInstr;
     CPU.IRopcode = instr >> opcodeShift;
     CPU.IRoperand = instr & operandMask;
     return (mNormal);
@@ -1,7 +1,14 @@
+#define _GNU_SOURCE   // writer-preferring rwlock
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include "simos.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define ageSIMD   // the age scan uses AVX2 when the cpu has it, see memory_agescan
+#endif
 
 // -----------------------------------------------------------------------------//
 // paging.c
@@ -46,16 +53,50 @@
 
 //mType *Memory;   // The physical memory
 typedef unsigned ageType;
+// the frame table, one array for each field of the frames, so that the
+// age scan runs over the contiguous age[] and free[] (memory_agescan)
 typedef struct
 {
-    int page, pid, next, prev;
-    char free, dirty, pin;
-    ageType age;
-}FrameStruct;
-
-
-FrameStruct* physicalFrame;
-int frameHead, frameTail;
+    int *page, *pid, *next, *prev;   // next, prev: resident set of the process
+    int *hnext;   // next frame in the reverse map chain
+    int *vnext, *vprev;   // victim list of the frame, see select_agest_frame
+    signed char *vlist;   // which victim list, NULLINDEX if none
+    char *free, *dirty, *pin;
+    char *ref;   // accessed since the last age scan
+    ageType *age;
+}FrameTable;
+
+
+FrameTable physicalFrame;
+
+
+// free frames, a bitmap with a summary, see lowest_free_frame
+typedef unsigned long long bitWord;
+#define bitsPerWord 64
+bitWord *freeMap, *freeSummary;
+int freeMapWords, summaryWords;
+int firstSummary;    // no summary word before it has a free frame
+int numFreeFrames;
+
+#define scanScalar 0   // how memory_agescan runs, set by initialize_memory
+#define scanAVX2 1
+int scanLevel = scanScalar;
+
+// reverse map from (pid, page) to frame, and the resident set of each
+// process, see rmap_lookup
+int *rmapBucket;    // first frame of each hash chain
+int rmapMask;       // #buckets - 1, a power of 2
+int *residentHead;  // first frame of each process
+
+// victim lists, the frames in use by age and dirty flag, see
+// select_agest_frame
+#define ageBits 32        // bits of ageType
+#define numVictimLists (2 * ageBits)
+int victimHead[numVictimLists], victimTail[numVictimLists];
+int victimShift;    // #age scans, mod ageBits
+char victimSorted[numVictimLists];   // the list is in age order
+typedef struct { ageType age; int seq, frame; } VictimKey;
+VictimKey *victimKey;   // for victim_sort
 unsigned pageOSMask;
 int pageNumShift;
 
@@ -74,6 +115,8 @@ int pagenumShift;
 #define CLEAN_FRAME 0
 #define USED_FRAME 0
 #define NONPIN_FRAME 0
+#define REF_FRAME 1
+#define UNREF_FRAME 0
 
 //-----------------------------------------------------------------------//
 
@@ -86,10 +129,10 @@ int pagenumShift;
 
 #define AGEZERO 0x00000000        // starting age
 #define AGEMAX 0x80000000         // max age
-#define SHIFT_CODE 24
-#define MASK_OPERAND 0x00ffffff
-#define FLAG_READ 1
-#define FLAG_WRITE 2
+#define SHIFT_CODE opcodeShift      // word format is set in simos.h
+#define MASK_OPERAND operandMask
+#define FLAG_READ flagRead     // rwflag is in simos.h
+#define FLAG_WRITE flagWrite
 
 // ---------------------------------------------------------------------------------
 
@@ -122,10 +165,22 @@ int calculate_memory_address(unsigned offset, int flag); //(Victor Chaing)
 
 
 void addto_freeMemoryFrame (int frame_index, int status); //(Surapa Phrompha)
+void agescan_scalar (int from, int to);
+void agescan_free (int base, unsigned mask);
+int agescan_avx2 (int from, int to);
+void set_free_bit (int frame);
+void clear_free_bit (int frame);
+int lowest_free_frame ();
 int find_allocated_memory(int pid, int page) ; //(Surapa Phrompha)
-int check_for_pending_page(int pid, int page); //(Surapa Phrompha)
-int find_next_page(int pid, int page);    //(Surapa Phrompha)
-int find_previous_page(int pid, int page);    //(Surapa Phrompha)
+int rmap_hash (int pid, int page);
+int rmap_lookup (int pid, int page);
+void rmap_add (int frame_index);
+void rmap_remove (int frame_index);
+int victim_list (int frame_index);
+void victim_sort (int list);
+void victim_link (int frame_index);
+void victim_unlink (int frame_index);
+void victim_rotate ();
 void display_frame(int index);  //(Victor Chaing)
 void display1FrameInfo(int index); //(Victor Chaing)
 void initialize_memory(); //(Victor Chaing)
@@ -137,7 +192,7 @@ int select_agest_frame (); //(Surapa Phrompha)
 
 
 //----------------------------------------------------------------------------------------//
-void direct_put_instruction (int findex, int offset, int instr);
+void direct_put_instruction (int findex, int offset, mwordType instr);
 void direct_put_data (int findex, int offset, mdType data);
 void initialize_physical_memory ();
 
@@ -171,7 +226,30 @@ void init_process_pagetable (int pid) // Surapa Phrompha
 // update by pointing to frame memory, disk, or null
 void update_process_pagetable (int pid, int page, int frame) // Surapa Phrompha
 {
+  count_page_change (pid, PCB[pid]->PTptr[page], frame);
   PCB[pid]->PTptr[page] = frame;
+  tlb_shootdown (pid, page);
+  icache_remap_page (pid, page, frame);
+}
+
+
+// purpose : resident and swapped page counts for the resource usage
+// a disk page and a pending page (being read) are in their swap slot
+void count_page_change (int pid, int from, int to)
+{
+    typePCB *p = PCB[pid];
+
+    if (from >= 0) p->residentPages--;
+    else if (from == DISKPAGE || from == PENDPAGE) p->swapPages--;
+    if (to >= 0) {
+        p->residentPages++;
+        if (p->residentPages > p->peakResident)
+            p->peakResident = p->residentPages;
+    }
+    else if (to == DISKPAGE || to == PENDPAGE) {
+        p->swapPages++;
+        if (p->swapPages > p->peakSwap) p->peakSwap = p->swapPages;
+    }
 }
 
 
@@ -183,17 +261,29 @@ void update_process_pagetable (int pid, int page, int frame) // Surapa Phrompha
 int free_process_memory (int pid)  // Surapa Phrompha
 {
   int page;
-  int j;
+  int j, next;
+  memory_lock_exclusive ();
+  // a read still in the swap queue holds a frame for its pending page
+  cancel_prefetch (pid);
+  for (j = residentHead[pid]; j != NULLINDEX; j = next)
+  {
+      next = physicalFrame.next[j];
+      if ((physicalFrame.free[j] == USED_FRAME) && (physicalFrame.page[j] >= 0)
+          && (PCB[pid]->PTptr[physicalFrame.page[j]] == PENDPAGE))
+      {
+          addto_freeMemoryFrame(j, NULLPAGE);
+      }
+  }
   for (page=0; page<maxPpages; page++)
   {
-      if (PCB[pid]->PTptr[page] != NULLPAGE)
+      if (PCB[pid]->PTptr[page] >= 0)   // disk pages hold no frame
       {
           for(j = PCB[pid]->PTptr[page] * pageSize; j < (PCB[pid]->PTptr[page] + 1) * pageSize; j++)
           {
             printf("--------------------------- \n");
             printf("Mem: 0x%032x, \n", j);
-            printf(" Data: 0x%016x, \n",Memory[j]);
-            printf(" %f\n",Memory[j].mData);
+            printf(" Data: "mwordFormat", \n",Memory[j].mInstr);
+            printf(" "mdOutFormat"\n",Memory[j].mData);
             printf("--------------------------- \n");
             Memory[j].mInstr=0;
           }
@@ -201,7 +291,9 @@ int free_process_memory (int pid)  // Surapa Phrompha
           addto_freeMemoryFrame(PCB[pid]->PTptr[page], NULLPAGE);
       }
   }
-
+  tlb_flush_process (pid);
+  icache_free_process (pid);
+  memory_unlock ();
 }
 
 //purspose : function dump_process_pagetable
@@ -267,51 +359,26 @@ void  update_frame_info (int frame_index, int pid, int page) // Surapa Phrompha
 
   //-----------------------------------------------------------------------------//
 
-  // use link list
-   // have to perfrom in this order
-   // otherwise, we cannot update the frame
-
-  if (physicalFrame[frame_index].prev != NULLINDEX)
-  {
-    physicalFrame[physicalFrame[frame_index].prev].next = physicalFrame[frame_index].next;
-  }
-
-  // the frame is update on this add
-  if (physicalFrame[frame_index].next != NULLINDEX)
-  {
-      physicalFrame[physicalFrame[frame_index].next].prev = physicalFrame[frame_index].prev;
-  }
-
-
-  //----------------------------------------------------------------------------------//
-
-  physicalFrame[frame_index].prev = find_previous_page(pid,page);
-
-
-  physicalFrame[frame_index].next = find_next_page(pid,page);
-
-  if (physicalFrame[frame_index].prev > NULLINDEX)
-  {
-    physicalFrame[physicalFrame[frame_index].prev].next = frame_index;
-
-  }
-
-  if (physicalFrame[frame_index].next > NULLINDEX)
-  {
-    physicalFrame[physicalFrame[frame_index].next].prev = frame_index;
-  }
+  // out of the reverse map and resident set under the old page
+  // (the frame may be reused), back in under the new one at the end
+  rmap_remove (frame_index);
+  victim_unlink (frame_index);
 
   //------------------------------------------------------------//
 
   // use max age
   // since the aging policy is used
-  physicalFrame[frame_index].age = AGEMAX;
-  physicalFrame[frame_index].free = USED_FRAME;
-  physicalFrame[frame_index].dirty = CLEAN_FRAME;
-  physicalFrame[frame_index].pin = NONPIN_FRAME;
-
-  physicalFrame[frame_index].pid = pid;
-  physicalFrame[frame_index].page = page;
+  physicalFrame.age[frame_index] = AGEMAX;
+  physicalFrame.ref[frame_index] = UNREF_FRAME;
+  physicalFrame.free[frame_index] = USED_FRAME;
+  clear_free_bit (frame_index);
+  physicalFrame.dirty[frame_index] = CLEAN_FRAME;
+  physicalFrame.pin[frame_index] = NONPIN_FRAME;
+
+  physicalFrame.pid[frame_index] = pid;
+  physicalFrame.page[frame_index] = page;
+  rmap_add (frame_index);
+  victim_link (frame_index);
 }
 
 
@@ -324,7 +391,7 @@ int page;
 
 printf("------------------------------------------------------------------- \n");
 printf ("Memory Frame Metadata\n");
-printf ("Memory frame head/tail: %d/%d\n", frameHead, frameTail);
+printf ("Memory free frames: %d, lowest: %d\n", numFreeFrames, lowest_free_frame());
 for (page=OSpages; page<numFrames; page++)
 {
 printf ("Frame %d: ", page);
@@ -334,14 +401,12 @@ printf("------------------------------------------------------------------- \n")
 
 
 
-int list  = frameHead;
-
 printf("------------------------------------------------------------------- \n");
 printf ("Free memory frame\n");
-while(list != NULLINDEX)
+for (page=OSpages; page<numFrames; page++)
 {
-  printf ("%d ", list);
-  list = physicalFrame[list].next;
+  if (freeMap[page / bitsPerWord] & (1ULL << (page % bitsPerWord)))
+    printf ("%d ", page);
 }
 printf("\n");
 printf("------------------------------------------------------------------- \n");
@@ -368,195 +433,44 @@ void dump_memory()  // Victor Chaing
 // 1: #define freeFrame 1
 // 2: nullIndex = null pointer
 // 3: nullPage = page doesn not exist
-// 4: clean frame = fields in FrameStruct
-// 5 : freeFrame = fields in FrameStruct
+// 4: clean frame = fields in FrameTable
+// 5 : freeFrame = fields in FrameTable
 void addto_freeMemoryFrame (int frame_index, int status) // Surapa Phrompha
 {
-  int temp;
+    // the decoded copy of the page in this frame is no longer valid
+    if (physicalFrame.pid[frame_index] != NULLINDEX)
+        icache_invalidate_page (physicalFrame.pid[frame_index], physicalFrame.page[frame_index]);
 
-    physicalFrame[frame_index].free = FREE_FRAME;
+    physicalFrame.free[frame_index] = FREE_FRAME;
 
+    // off the reverse map, the resident set of the process and the victim lists
+    rmap_remove (frame_index);
+    victim_unlink (frame_index);
 
     if (status == NULLPAGE)
   {
-        physicalFrame[frame_index].pid = NULLINDEX;
-        physicalFrame[frame_index].page = NULLPAGE;
-        physicalFrame[frame_index].dirty = CLEAN_FRAME;
-    }
-
-    if (physicalFrame[frame_index].prev != NULLINDEX)
-    {
-        physicalFrame[physicalFrame[frame_index].prev].next = physicalFrame[frame_index].next;
-    }
-
-
-
-    if (physicalFrame[frame_index].next != NULLINDEX)
-  {
-
-        physicalFrame[physicalFrame[frame_index].next].prev = physicalFrame[frame_index].prev;
+        physicalFrame.pid[frame_index] = NULLINDEX;
+        physicalFrame.page[frame_index] = NULLPAGE;
+        physicalFrame.dirty[frame_index] = CLEAN_FRAME;
     }
 
-    if (frameHead == NULLINDEX)
-  {
-        physicalFrame[frame_index].prev = NULLINDEX;
-        physicalFrame[frame_index].next = NULLINDEX;
-        frameHead = frame_index;
-        frameTail = frame_index;
-    }
-  else if(frame_index > frameTail)
-  {
-          physicalFrame[frame_index].prev=frameTail;
-          physicalFrame[frame_index].next = NULLINDEX;
-          physicalFrame[frameTail].next = frame_index;
-          frameTail = frame_index;
-      }
-      else if (frame_index < frameHead)
-    {
-          physicalFrame[frame_index].next=frameHead;
-          physicalFrame[frame_index].prev = NULLINDEX;
-          physicalFrame[frameHead].prev = frame_index;
-          frameHead = frame_index;
-      }
-      else
-    {
-        temp = frameHead;
-        while (frame_index > temp)
-    {
-      temp = physicalFrame[temp].next;
-    }
-        physicalFrame[frame_index].prev = physicalFrame[temp].prev;
-        physicalFrame[frame_index].next = temp;
-        physicalFrame[physicalFrame[temp].prev].next = frame_index;
-        physicalFrame[temp].prev = frame_index;
-      }  // end else
+    // into the free frame bitmap
+    set_free_bit (frame_index);
 
 
-    if (physicalFrame[frame_index].dirty == CLEAN_FRAME)
+    if (physicalFrame.dirty[frame_index] == CLEAN_FRAME)
     {
-        physicalFrame[frame_index].pid = NULLINDEX;
-        physicalFrame[frame_index].pid = NULLPAGE;
+        physicalFrame.pid[frame_index] = NULLINDEX;
+        physicalFrame.pid[frame_index] = NULLPAGE;
     }
 } // end method
 
 
+// purpose : the frame that holds, or is being read for, page of pid
+// NULLINDEX if there is none, see the reverse map
 int find_allocated_memory(int pid, int page) //Surapa Phrompha
 {
-    int allocated_memory;
-
-    // check for next page
-    allocated_memory = find_next_page(pid, -1);
-    // chekc whether page exist in the memory or not
-    while ((physicalFrame[allocated_memory].page!=page) && (allocated_memory!= NULLINDEX))
-    {
-      // traverse theough the linked list of the memeory
-      // until the page is found
-      allocated_memory = physicalFrame[allocated_memory].next;
-    }
-    // retun the idex of page found
-    return allocated_memory;
-}
-
-
-// purpose : to find the pending page
-// Note :
-     // OSpages = #pages for OS, OS occupies the begining of the memory
-int check_for_pending_page(int pid, int page) //Surapa Phrompha
-{
-    int pendingpage = OSpages;
-
-
-    while (physicalFrame[pendingpage].pid!=pid)
-    {
-        pendingpage++;
-
-        // if chack until the max pages
-        if (pendingpage==maxPpages)
-        {
-          // it point to the null index
-          return NULLINDEX;
-        }
-    }
-
-
-    while (physicalFrame[pendingpage].prev != NULLINDEX)
-    {
-      // get to first frame of pid
-      pendingpage = physicalFrame[pendingpage].prev;
-    }
-
-    // traverse through the memory frame until found
-    // the pending page
-    while ((pendingpage!= NULLINDEX) && ((physicalFrame[pendingpage].page!=page) || (physicalFrame[pendingpage].pid!=pid)))
-    {
-
-      pendingpage = physicalFrame[pendingpage].next;
-    }
-    return pendingpage;
-}
-
-// purpose : traverse to get the next page
-//           that is not null page or disk page
-//           (traverse to the left)
-int find_next_page(int pid, int page) //Surapa Phrompha
-{
-    int i = page+1;
-    // traverse throght the page table
-    while (i!=maxPpages)
-    {
-      // case 1 :
-        if ((PCB[pid]->PTptr[i]==NULLPAGE) ||  (PCB[pid]->PTptr[i]==DISKPAGE))
-        {
-          // if it is null page or disk pages
-          // skip
-            i++;
-        }
-        else if (PCB[pid]->PTptr[i]==PENDPAGE)  // case 2 : it it is pending page
-        {
-           printf("Pending page\n");
-           return check_for_pending_page(pid, i);
-        }
-        else
-        {
-             // return the next page if find
-            return PCB[pid]->PTptr[i];
-        }
-    }
-    // if reach the max page
-    // to next pages
-    // reuturn null index
-    return NULLINDEX;
-}
-
-// purpose : treverse to get the prevous page
-//           traverse to the right
-int find_previous_page(int pid, int currentPage) //Surapa Phrompha
-{
-    // from the current page
-    int i = currentPage-1;
-    // traverse to the right
-    while (i!=-1)
-    {
-        // case 1 : if it is null page or the disk page
-        if ((PCB[pid]->PTptr[i]==NULLPAGE) ||  (PCB[pid]->PTptr[i]==DISKPAGE))
-        {
-          // skip
-            i=i-1;
-        }
-        else if (PCB[pid]->PTptr[i]==PENDPAGE) // case 2: if it is pending page
-        {
-          printf("Pending page\n");
-            return check_for_pending_page(pid, i);
-        }
-        else
-        {
-          // reuturn the find_previous_page
-          // if it is not the previous two case
-            return PCB[pid]->PTptr[i];
-        }
-    }
-    // otherwise return null index
-    return NULLINDEX;
+    return rmap_lookup (pid, page);
 }
 
 
@@ -576,8 +490,8 @@ void display_frame(int index) // (Vitor Chaing)
     {
         printf("-------------------------------------------- \n");
         printf("Memory: 0x%032x \n", i);
-        printf("Data: 0x%016x \n", Memory[i]);
-        printf("%f \n", Memory[i].mData);
+        printf("Data: "mwordFormat" \n", Memory[i].mInstr);
+        printf(mdOutFormat" \n", Memory[i].mData);
         printf("-------------------------------------------- \n");
     }
 }
@@ -585,14 +499,15 @@ void display_frame(int index) // (Vitor Chaing)
 //function display1FrameInfo
 void display1FrameInfo(int index) // (Vitor Chaing)
 {
-    printf("pid: %d, ", physicalFrame[index].pid);
-    printf("page: %d, ", physicalFrame[index].page);
-    printf("age: %x, ", physicalFrame[index].age);
-    printf("dir: %d, ", physicalFrame[index].dirty);
-    printf("free: %d, ", physicalFrame[index].free);
-    printf("pin: %d, ", physicalFrame[index].pin);
-    printf("next: %d, ", physicalFrame[index].next);
-    printf("prev: %d", physicalFrame[index].prev);
+    printf("pid: %d, ", physicalFrame.pid[index]);
+    printf("page: %d, ", physicalFrame.page[index]);
+    printf("age: %x, ", physicalFrame.age[index]);
+    printf("dir: %d, ", physicalFrame.dirty[index]);
+    printf("free: %d, ", physicalFrame.free[index]);
+    printf("pin: %d, ", physicalFrame.pin[index]);
+    printf("ref: %d, ", physicalFrame.ref[index]);
+    printf("next: %d, ", physicalFrame.next[index]);
+    printf("prev: %d", physicalFrame.prev[index]);
     printf("\n");
 }
 
@@ -609,42 +524,85 @@ void display1FrameInfo(int index) // (Vitor Chaing)
 
 void initialize_memory()  // Victor Chiang
 {
-    physicalFrame = (FrameStruct*)malloc(numFrames * sizeof(FrameStruct));
+    physicalFrame.page = (int*)malloc(numFrames * sizeof(int));
+    physicalFrame.pid = (int*)malloc(numFrames * sizeof(int));
+    physicalFrame.next = (int*)malloc(numFrames * sizeof(int));
+    physicalFrame.prev = (int*)malloc(numFrames * sizeof(int));
+    physicalFrame.hnext = (int*)malloc(numFrames * sizeof(int));
+    physicalFrame.vnext = (int*)malloc(numFrames * sizeof(int));
+    physicalFrame.vprev = (int*)malloc(numFrames * sizeof(int));
+    physicalFrame.vlist = (signed char*)malloc(numFrames);
+    physicalFrame.free = (char*)malloc(numFrames);
+    physicalFrame.dirty = (char*)malloc(numFrames);
+    physicalFrame.pin = (char*)malloc(numFrames);
+    physicalFrame.ref = (char*)calloc(numFrames, 1);   // UNREF_FRAME
+    physicalFrame.age = (ageType*)malloc(numFrames * sizeof(ageType));
+    victimKey = (VictimKey*)malloc(numFrames * sizeof(VictimKey));
+#ifdef ageSIMD
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2")) scanLevel = scanAVX2;
+#endif
     Memory = (mType*)malloc(numFrames * pageSize * sizeof(mType));
     pageOSMask = (OSpages - 1) * pageSize - 1;
     pageNumShift = (int)(log((double)(OSpages - 1.0) * pageSize) / log(2.0));
-    frameHead = OSpages;
-    frameTail = numFrames - 1;
+    freeMapWords = (numFrames + bitsPerWord - 1) / bitsPerWord;
+    summaryWords = (freeMapWords + bitsPerWord - 1) / bitsPerWord;
+    freeMap = (bitWord *) calloc (freeMapWords, sizeof (bitWord));
+    freeSummary = (bitWord *) calloc (summaryWords, sizeof (bitWord));
+    numFreeFrames = 0;
+    firstSummary = summaryWords;
+    for (rmapMask = 1; rmapMask < numFrames; rmapMask = rmapMask << 1);
+    rmapBucket = (int *) malloc (rmapMask * sizeof (int));
+    for (int i = 0; i < rmapMask; i++) rmapBucket[i] = NULLINDEX;
+    rmapMask = rmapMask - 1;
+    residentHead = (int *) malloc (maxProcess * sizeof (int));
+    for (int i = 0; i < maxProcess; i++) residentHead[i] = NULLINDEX;
+    for (int i = 0; i < numFrames; i++) {
+        physicalFrame.next[i] = NULLINDEX;
+        physicalFrame.prev[i] = NULLINDEX;
+        physicalFrame.hnext[i] = NULLINDEX;
+        physicalFrame.vlist[i] = NULLINDEX;
+    }
+    for (int i = 0; i < numVictimLists; i++) {
+        victimHead[i] = NULLINDEX;
+        victimTail[i] = NULLINDEX;
+        victimSorted[i] = 1;
+    }
+    victimShift = 0;
     for (int i = 0; i < OSpages; i++) {
-        physicalFrame[i].pid = osPid;
-        physicalFrame[i].page = NULLPAGE;
-        physicalFrame[i].age = AGEZERO;
-        physicalFrame[i].free = USED_FRAME;
-        physicalFrame[i].dirty = CLEAN_FRAME;
-        physicalFrame[i].pin = PIN_FRAME;
+        physicalFrame.pid[i] = osPid;
+        physicalFrame.page[i] = NULLPAGE;
+        physicalFrame.age[i] = AGEZERO;
+        physicalFrame.free[i] = USED_FRAME;
+        physicalFrame.dirty[i] = CLEAN_FRAME;
+        physicalFrame.pin[i] = PIN_FRAME;
     }
     for (int i = OSpages; i < numFrames; i++) {
-        physicalFrame[i].free = USED_FRAME;
-        if (i == 0) {
-            physicalFrame[i].next = i + 1;
-            physicalFrame[i].prev = NULLINDEX;
-        }
-        else if (i == numFrames - 1) {
-            physicalFrame[i].next = NULLINDEX;
-            physicalFrame[i].prev = i - 1;
-        }
-        else {
-            physicalFrame[i].next = i + 1;
-            physicalFrame[i].prev = i - 1;
-        }
-        physicalFrame[i].pid = NULLINDEX;
-        physicalFrame[i].age = AGEZERO;
-        physicalFrame[i].free = FREE_FRAME;
-        physicalFrame[i].dirty = CLEAN_FRAME;
-        physicalFrame[i].pin = NONPIN_FRAME;
+        set_free_bit (i);
+        physicalFrame.pid[i] = NULLINDEX;
+        physicalFrame.age[i] = AGEZERO;
+        physicalFrame.free[i] = FREE_FRAME;
+        physicalFrame.dirty[i] = CLEAN_FRAME;
+        physicalFrame.pin[i] = NONPIN_FRAME;
     }
 }
 
+// purpose : mark the frame as accessed, the next age scan takes the
+// referenced bit into the age; the flags are only written when they
+// change, most accesses just read them
+void reference_frame (int frame_index)
+{
+    if (physicalFrame.ref[frame_index] != REF_FRAME)
+        physicalFrame.ref[frame_index] = REF_FRAME;
+}
+
+// purpose : mark the frame as written
+void dirty_frame (int frame_index)
+{
+    if (physicalFrame.dirty[frame_index] != DIRTY_FRAME)
+        physicalFrame.dirty[frame_index] = DIRTY_FRAME;
+}
+
 //function calculate_memory_address
 int calculate_memory_address(unsigned offset, int flag) // Victor Chiang
 {
@@ -661,13 +619,25 @@ int calculate_memory_address(unsigned offset, int flag) // Victor Chiang
         return mError;
     }
 
-    int frame = CPU.PTptr[index];
+    // try the TLB first, only resident pages are kept in it
+    int frame;
+    typeTLBentry *tlb = &CPU.TLB[index & (tlbSize - 1)];
+
+    if ((tlb->pid == CPU.Pid) && (tlb->page == index)) {
+        CPU.tlbHits++;
+        frame = tlb->frame;
+    }
+    else {
+        CPU.tlbMisses++;
+        frame = CPU.PTptr[index];
+    }
 
     if ((frame == NULLPAGE) && (flag == FLAG_READ)) {
         return mError;
     }
     else if (frame == DISKPAGE) {
         if ((flag == FLAG_READ) || (flag == FLAG_WRITE)) {
+            CPU.faultPage = index;
             set_interrupt(pFaultException);
             return mPFault;
         }
@@ -676,28 +646,252 @@ int calculate_memory_address(unsigned offset, int flag) // Victor Chiang
         }
     }
     else if (frame == PENDPAGE) {
+        // being prefetched, the handler waits for the read in the swap queue
+        CPU.faultPage = index;
+        set_interrupt(pFaultException);
         return mPFault;
     }
     else {
         if ((frame == NULLPAGE) && (flag == FLAG_WRITE)) {
+            // the frame table changes, trade the shared lock for the
+            // exclusive one, only the running process maps its null pages
+            memory_unlock ();
+            memory_lock_exclusive ();
             frame = get_free_frame();
             update_frame_info(frame, CPU.Pid, index);
             update_process_pagetable(CPU.Pid, index, frame);
+            memory_unlock ();
+            memory_lock_shared ();
         }
+        tlb->pid = CPU.Pid;
+        tlb->page = index;
+        tlb->frame = frame;
 
         int address = (frame * pageSize) + (offset - index * pageSize);
 
-        if (flag == FLAG_WRITE) {
-            physicalFrame[frame].dirty = DIRTY_FRAME;
+        // only written when they change, as in reference_frame
+        if ((flag == FLAG_WRITE) && (physicalFrame.dirty[frame] != DIRTY_FRAME)) {
+            physicalFrame.dirty[frame] = DIRTY_FRAME;
+        }
+        if (physicalFrame.ref[frame] != REF_FRAME) {
+            physicalFrame.ref[frame] = REF_FRAME;
         }
-        physicalFrame[frame].age = AGEMAX;
 
         return address;
     }
 }
 
+// --------------------- //
+// Memory Lock           //
+// --------------------- //
+
+// the frame table and the page tables are shared by all the cores
+// a core holds memLock shared while it runs instructions, so the
+// translations it uses (page table entries, its TLB) stay valid
+// the page fault handler, age scan, process exit, loader and the swap
+// thread change them holding memLock exclusively, which waits for the
+// running cores to finish their current instruction or batch
+// writers are preferred, the cores take the lock again right away
+// a waiting writer counts itself in memLockWanted, which cuts the batch
+// of every running core short (batch_break, simos.h)
+// lock order: memLock before swap_mutex (swap.c)
+
+pthread_rwlock_t memLock;
+
+void initialize_memory_lock ()
+{
+    pthread_rwlockattr_t attr;
+
+    pthread_rwlockattr_init (&attr);
+    pthread_rwlockattr_setkind_np (&attr,
+                                   PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init (&memLock, &attr);
+    pthread_rwlockattr_destroy (&attr);
+}
+
+void memory_lock_shared ()
+{
+    pthread_rwlock_rdlock (&memLock);
+}
+
+void memory_lock_exclusive ()
+{
+    __sync_fetch_and_add (&memLockWanted, 1);
+    pthread_rwlock_wrlock (&memLock);
+    __sync_fetch_and_sub (&memLockWanted, 1);
+}
+
+void memory_unlock ()
+{
+    pthread_rwlock_unlock (&memLock);
+}
+
+// --------------------- //
+// Software TLB          //
+// --------------------- //
+
+// every shootdown bumps mapEpoch, so translations cached outside the
+// TLB (jit.c) can tell that the mapping may have changed
+// each core has its own TLB, a shootdown goes to all of them; the caller
+// holds memLock exclusively, so no core is using its TLB meanwhile
+
+// purpose : drop the translation of (pid, page) from the TLB
+void tlb_shootdown (int pid, int page)
+{
+    mapEpoch++;
+    for (int k = 0; k < numCores; k++) {
+        typeTLBentry *tlb = &cpuCores[k].TLB[page & (tlbSize - 1)];
+
+        if ((tlb->pid == pid) && (tlb->page == page)) {
+            tlb->pid = nullPid;
+        }
+    }
+}
+
+// purpose : drop any translation to the frame (frame is being reused)
+// and its lines in the cache model
+void tlb_shootdown_frame (int frame_index)
+{
+    mapEpoch++;
+    cache_flush_frame (frame_index);
+    for (int k = 0; k < numCores; k++) {
+        typeTLBentry *tlb = cpuCores[k].TLB;
+
+        for (int i = 0; i < tlbSize; i++) {
+            if ((tlb[i].pid != nullPid) && (tlb[i].frame == frame_index)) {
+                tlb[i].pid = nullPid;
+            }
+        }
+    }
+}
+
+// purpose : drop all translations of a process
+void tlb_flush_process (int pid)
+{
+    mapEpoch++;
+    for (int k = 0; k < numCores; k++) {
+        typeTLBentry *tlb = cpuCores[k].TLB;
+
+        for (int i = 0; i < tlbSize; i++) {
+            if (tlb[i].pid == pid) {
+                tlb[i].pid = nullPid;
+            }
+        }
+    }
+}
+
+void dump_tlb (FILE *outf)
+{
+    fprintf (outf, "******************** TLB Dump\n");
+    for (int k = 0; k < numCores; k++) {
+        typeCPU *core = &cpuCores[k];
+        unsigned total = core->tlbHits + core->tlbMisses;
+
+        if (numCores > 1) {
+            fprintf (outf, "Core %d: ", k);
+        }
+        fprintf (outf, "hits=%u, misses=%u, hit rate=%.2f%%\n",
+                 core->tlbHits, core->tlbMisses,
+                 (total == 0) ? 0.0 : 100.0 * core->tlbHits / total);
+        for (int i = 0; i < tlbSize; i++) {
+            if (core->TLB[i].pid != nullPid) {
+                fprintf (outf, "Entry %d: pid=%d, page=%d, frame=%d\n",
+                         i, core->TLB[i].pid, core->TLB[i].page,
+                         core->TLB[i].frame);
+            }
+        }
+    }
+}
+
+// --------------------- //
+// Checkpoint            //
+// --------------------- //
+
+// purpose : save Memory[] and the frame table with its free list
+// (checkpoint.c), called with memLock held exclusively
+void checkpoint_memory ()
+{
+    ckpt_write (Memory, (long long) numFrames * pageSize * sizeof (mType));
+    ckpt_write (physicalFrame.page, numFrames * sizeof (int));
+    ckpt_write (physicalFrame.pid, numFrames * sizeof (int));
+    ckpt_write (physicalFrame.next, numFrames * sizeof (int));
+    ckpt_write (physicalFrame.prev, numFrames * sizeof (int));
+    ckpt_write (physicalFrame.vnext, numFrames * sizeof (int));
+    ckpt_write (physicalFrame.vprev, numFrames * sizeof (int));
+    ckpt_write (physicalFrame.vlist, numFrames);
+    ckpt_write (physicalFrame.free, numFrames);
+    ckpt_write (physicalFrame.dirty, numFrames);
+    ckpt_write (physicalFrame.pin, numFrames);
+    ckpt_write (physicalFrame.ref, numFrames);
+    ckpt_write (physicalFrame.age, numFrames * sizeof (ageType));
+    ckpt_write (residentHead, maxProcess * sizeof (int));
+    ckpt_write (victimHead, sizeof (victimHead));
+    ckpt_write (victimTail, sizeof (victimTail));
+    ckpt_write (victimSorted, sizeof (victimSorted));
+    ckpt_write_int (victimShift);
+}
+
+// purpose : put Memory[] and the frame table back, the PCBs are already
+// restored; the decoded pages are rebuilt from the resident code pages
+void restore_memory ()
+{
+    memcpy (Memory, ckpt_read ((long long) numFrames * pageSize * sizeof (mType)),
+            (long long) numFrames * pageSize * sizeof (mType));
+    memcpy (physicalFrame.page, ckpt_read (numFrames * sizeof (int)), numFrames * sizeof (int));
+    memcpy (physicalFrame.pid, ckpt_read (numFrames * sizeof (int)), numFrames * sizeof (int));
+    memcpy (physicalFrame.next, ckpt_read (numFrames * sizeof (int)), numFrames * sizeof (int));
+    memcpy (physicalFrame.prev, ckpt_read (numFrames * sizeof (int)), numFrames * sizeof (int));
+    memcpy (physicalFrame.vnext, ckpt_read (numFrames * sizeof (int)), numFrames * sizeof (int));
+    memcpy (physicalFrame.vprev, ckpt_read (numFrames * sizeof (int)), numFrames * sizeof (int));
+    memcpy (physicalFrame.vlist, ckpt_read (numFrames), numFrames);
+    memcpy (physicalFrame.free, ckpt_read (numFrames), numFrames);
+    memcpy (physicalFrame.dirty, ckpt_read (numFrames), numFrames);
+    memcpy (physicalFrame.pin, ckpt_read (numFrames), numFrames);
+    memcpy (physicalFrame.ref, ckpt_read (numFrames), numFrames);
+    memcpy (physicalFrame.age, ckpt_read (numFrames * sizeof (ageType)),
+            numFrames * sizeof (ageType));
+    memcpy (residentHead, ckpt_read (maxProcess * sizeof (int)),
+            maxProcess * sizeof (int));
+    memcpy (victimHead, ckpt_read (sizeof (victimHead)), sizeof (victimHead));
+    memcpy (victimTail, ckpt_read (sizeof (victimTail)), sizeof (victimTail));
+    memcpy (victimSorted, ckpt_read (sizeof (victimSorted)), sizeof (victimSorted));
+    victimShift = ckpt_read_int ();
+    mapEpoch++;
+
+    // the reverse map follows from the resident sets
+    for (int i = 0; i <= rmapMask; i++) rmapBucket[i] = NULLINDEX;
+    for (int pid = 0; pid < maxProcess; pid++) {
+        for (int i = residentHead[pid]; i != NULLINDEX; i = physicalFrame.next[i]) {
+            int h = rmap_hash (pid, physicalFrame.page[i]);
+            physicalFrame.hnext[i] = rmapBucket[h];
+            rmapBucket[h] = i;
+        }
+    }
+
+    // the free frame bitmap follows from the free flags
+    memset (freeMap, 0, freeMapWords * sizeof (bitWord));
+    memset (freeSummary, 0, summaryWords * sizeof (bitWord));
+    numFreeFrames = 0;
+    firstSummary = summaryWords;
+    for (int i = OSpages; i < numFrames; i++) {
+        if (physicalFrame.free[i] == FREE_FRAME) set_free_bit (i);
+    }
+
+    for (int i = 0; i < numFrames; i++) {
+        int pid = physicalFrame.pid[i];
+        int page = physicalFrame.page[i];
+
+        if ((physicalFrame.free[i] == USED_FRAME) && (pid >= idlePid)
+            && (pid < maxProcess) && (page >= 0) && (page < maxPpages)
+            && (PCB[pid] != NULL) && (PCB[pid]->PTptr[page] == i)) {
+            icache_load_page (pid, page, i);
+        }
+    }
+}
+
 void initialize_mframe_manager () // Victor Chiang
 {
+  initialize_memory_lock();
   initialize_memory();
   // initialize memory
 }
@@ -723,24 +917,25 @@ void initialize_memory_manager ()
 
 void page_fault_handler () // Surapa Phrompha
 {
-  unsigned *temp = (unsigned *) malloc (pageSize*sizeof(unsigned));
+  mwordType *temp = (mwordType *) malloc (pageSize*sizeof(mwordType));
 
   int pidin = CPU.Pid;
-  int instruction_page;
-  int dataPage;
   int pageIn;
-  int frame;
+  int frame = NULLINDEX;
 
+  memory_lock_exclusive ();
+  charge_os (osFault);   // fault entry and handling, see clock.c
  // increment the number of page fault
   PCB[CPU.Pid]->numPF++;
 
-  instruction_page = CPU.PC/pageSize;
+  // the page calculate_memory_address could not translate: the
+  // instruction page, or the page of either address of an indirect load
+  pageIn = CPU.faultPage;
+  printf("Page Fault has occurred for: process %d", CPU.Pid);
+  printf("page %d \n",pageIn);
 
-  if (CPU.PTptr[instruction_page] == DISKPAGE)
+  if (CPU.PTptr[pageIn] == DISKPAGE)
   {
-    printf("Page Fault has occurred for: process %d", CPU.Pid);
-    printf("page %d \n",instruction_page);
-
       // get the free frame
       // see the process in the get free frame functions
           // obtain a free frame
@@ -750,45 +945,70 @@ void page_fault_handler () // Surapa Phrompha
 
       display_pagefault(frame);
       // update the frame metadata and the page tables of the involved processes
-      update_frame_info(frame, CPU.Pid, instruction_page);
-      update_process_pagetable(CPU.Pid, instruction_page, PENDPAGE);
+      update_frame_info(frame, CPU.Pid, pageIn);
+      update_process_pagetable(CPU.Pid, pageIn, PENDPAGE);
+      account_state(pidin, rsPFWait);
       // insert a read request to swapQ to bring the new page to this frame
-      insert_swapQ(pidin, instruction_page, temp, actRead, toReady);
+      insert_swapQ(pidin, pageIn, temp, actRead, toReady);
+      // queue reads for the pages the process will touch next
+      run_ahead (pidin);
   }
-  else if (CPU.PTptr[instruction_page] == PENDPAGE)
+  else if (CPU.PTptr[pageIn] == PENDPAGE)
   {
-      printf("Page Fault has occurred for: process %d", CPU.Pid);
-      printf("page %d \n",instruction_page);
-
+      // a prefetch read of the page is in the swap queue,
+      // the process is readied when it is done (prefetch_waiting)
+      PCB[CPU.Pid]->pfWaitPage = pageIn;
+      account_state(pidin, rsPFWait);
+      free (temp);
+      run_ahead (pidin);   // keep the swap queue ahead of the process
   }
   else
   {
+      // the prefetch read was done before the handler got the lock
+      printf("Page is already int the memory\n");
+      CPU.exeStatus = eRun;
+      free (temp);
+  }
+  if (frame != NULLINDEX) display1FrameInfo(frame);
+  memory_unlock ();
+}
 
-      dataPage = (CPU.dataOffset + CPU.IRoperand) / pageSize;
-      printf("Page Fault has occurred for: process %d", CPU.Pid);
-      printf("page %d \n",dataPage);
-
-      if (CPU.PTptr[dataPage] == DISKPAGE)
-      {
-          frame = get_free_frame();
-
-          display_pagefault(frame);
-          update_frame_info(frame, CPU.Pid, dataPage);
+// --------------------- //
+// Prefetch              //
+// --------------------- //
 
-          update_process_pagetable(CPU.Pid, dataPage, PENDPAGE);
+// purpose : bring a disk page in ahead of its page fault, for run-ahead
+// only a free frame is taken, a prefetch never evicts a page
+// the read does not ready the process, see prefetch_waiting
+// called with memLock held exclusively
+int prefetch_page (int pid, int page)
+{
+  mwordType *temp;
+  int frame;
 
-          insert_swapQ(pidin, dataPage, temp, actRead, toReady);
-      }
-      else if (CPU.PTptr[dataPage] == PENDPAGE)
-      {
+  if ((PCB[pid]->PTptr[page] != DISKPAGE) || (numFreeFrames == 0)) return 0;
+  temp = (mwordType *) malloc (pageSize*sizeof(mwordType));
+  frame = get_free_frame();
+  update_frame_info(frame, pid, page);
+  update_process_pagetable(pid, page, PENDPAGE);
+  insert_swapQ(pid, page, temp, actRead, prefetchRead);
+  PCB[pid]->numPrefetch++;
+  if (memDebug) printf("Prefetch for: process %d page %d \n", pid, page);
+  return 1;
+}
 
-      }
-      else {
-          printf("Page is already int the memory\n");
-      }
-  }
-  display1FrameInfo(frame);
+// purpose : check whether pid waits for a prefetched page that is in now
+// called by swap.c (memLock held) and clock.c when a prefetch read is done
+// in either case the process has to be readied by the caller
+int prefetch_waiting (int pid)
+{
+  int page;
 
+  if (PCB[pid] == NULL) return 0;   // exited, the read was cancelled
+  page = PCB[pid]->pfWaitPage;
+  if ((page == nullWait) || (PCB[pid]->PTptr[page] < 0)) return 0;
+  PCB[pid]->pfWaitPage = nullWait;
+  return 1;
 }
 
 //  Page Replacement Policy (Surapa Phrompha)
@@ -797,28 +1017,77 @@ void page_fault_handler () // Surapa Phrompha
 // Note
   // 1 : Ospages = #pages for OS, OS occupies the begining of the memory (in simoes.h)
   // 2: numFrames = sizes related to memory and memory management in (simos.h)
+// 3 : with AVX2 the ages are shifted and the frames in use whose age
+//     becomes 0 are found 8 frames at a time; these few frames are then
+//     freed one by one, in frame order, as the scalar scan does
+// 4 : an access only sets the referenced bit of the frame (reference_frame),
+//     the scan takes it into the age: age = (age >> 1) | ref << 31
 void memory_agescan () // Surapa Phrompha
   {
-    // traverse the os page
-      for(int page =OSpages; page <numFrames; page++)
-        {
-              // this is the memeory acces part
-          if(physicalFrame[page].age!=0)
-          {
-           // in each scan right shit the age vector of every memory fram
-            physicalFrame[page].age=physicalFrame[page].age>>1;
+      int frame = OSpages;
+
+      memory_lock_exclusive ();
+#ifdef ageSIMD
+      if (scanLevel == scanAVX2) frame = agescan_avx2 (frame, numFrames);
+#endif
+      agescan_scalar (frame, numFrames);   // the frames left over
+      victim_rotate ();
+      memory_unlock ();
+}
 
-          }
-          // when the aging vector of a memory frame become 0
-          if ((physicalFrame[page].age==0) && (physicalFrame[page].free != FREE_FRAME))
-          {
-            // the frame is free_frame_inturn to the freelis if it is dirty.
-            // fram index and fram status
-              addto_freeMemoryFrame (page, physicalFrame[page].dirty);
-          } // end for
-        } // end function
+// frames from .. to-1, one at a time
+void agescan_scalar (int from, int to)
+{
+    for (int frame = from; frame < to; frame++) {
+        // in each scan right shift the age vector of every memory frame,
+        // the referenced bit goes in at the top and is cleared
+        physicalFrame.age[frame] = (physicalFrame.age[frame] >> 1)
+                                   | ((ageType) physicalFrame.ref[frame] << (ageBits - 1));
+        physicalFrame.ref[frame] = UNREF_FRAME;
+        // when the aging vector of a frame in use becomes 0, it is freed
+        if ((physicalFrame.age[frame] == 0) && (physicalFrame.free[frame] != FREE_FRAME))
+            addto_freeMemoryFrame (frame, physicalFrame.dirty[frame]);
+    }
+}
+
+// free the frames of mask, bit i is frame base+i
+void agescan_free (int base, unsigned mask)
+{
+    while (mask != 0) {
+        int frame = base + __builtin_ctz (mask);
+        addto_freeMemoryFrame (frame, physicalFrame.dirty[frame]);
+        mask = mask & (mask - 1);
+    }
 }
 
+#ifdef ageSIMD
+
+// frames from .. to-1 in blocks of 8, returns the first frame not done
+__attribute__ ((target ("avx2")))
+int agescan_avx2 (int from, int to)
+{
+    __m256i zero = _mm256_setzero_si256 ();
+    __m256i freeFlag = _mm256_set1_epi32 (FREE_FRAME);
+    __m256i age, ref, isFree, found;
+    int frame;
+
+    for (frame = from; frame + 8 <= to; frame += 8) {
+        age = _mm256_loadu_si256 ((__m256i *) &physicalFrame.age[frame]);
+        ref = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((__m128i *) &physicalFrame.ref[frame]));
+        age = _mm256_or_si256 (_mm256_srli_epi32 (age, 1), _mm256_slli_epi32 (ref, ageBits - 1));
+        _mm256_storeu_si256 ((__m256i *) &physicalFrame.age[frame], age);
+        _mm_storel_epi64 ((__m128i *) &physicalFrame.ref[frame], _mm_setzero_si128 ());
+        isFree = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((__m128i *) &physicalFrame.free[frame]));
+        isFree = _mm256_cmpeq_epi32 (isFree, freeFlag);
+        found = _mm256_andnot_si256 (isFree, _mm256_cmpeq_epi32 (age, zero));
+        if (!_mm256_testz_si256 (found, found))
+            agescan_free (frame, _mm256_movemask_ps (_mm256_castsi256_ps (found)));
+    }
+    return frame;
+}
+
+#endif
+
 
 //-----------------------------------------------------------------------------------------------------//
 
@@ -828,11 +1097,11 @@ void memory_agescan () // Surapa Phrompha
 
 void display_pagefault(int frame_index)
 {
-    if (physicalFrame[frame_index].free == USED_FRAME)
+    if (physicalFrame.free[frame_index] == USED_FRAME)
   {
         printf("There were no free frame available. \n");
     }
-  else if (physicalFrame[frame_index].free == FREE_FRAME)
+  else if (physicalFrame.free[frame_index] == FREE_FRAME)
   {
         printf("There is freeframe\n");
     }
@@ -840,37 +1109,271 @@ void display_pagefault(int frame_index)
 }
 
 
+// --------------------- //
+// Reverse map           //
+// --------------------- //
+
+// purpose : find the frame of (pid, page) without walking page tables or
+// frame lists. A frame that update_frame_info gives to a page of a
+// process is, until it is freed or given to another page,
+//   - in the hash chain of (pid, page): rmapBucket, physicalFrame.hnext
+//   - in the resident set of the process: residentHead, physicalFrame.next
+//     and prev, a doubly linked list in no particular order
+// so a lookup, adding and removing a frame are O(1) on average
+// All are called with memLock held exclusively
+
+int rmap_hash (int pid, int page)
+{
+    unsigned key = (unsigned) pid * maxPpages + page;
+
+    return (key * 2654435761u) & rmapMask;   // odd multiplier, a bijection
+}
+
+int rmap_lookup (int pid, int page)
+{
+    int frame;
+
+    if ((pid < 0) || (pid >= maxProcess) || (page < 0)) return NULLINDEX;
+    frame = rmapBucket[rmap_hash (pid, page)];
+    while ((frame != NULLINDEX)
+           && ((physicalFrame.pid[frame] != pid) || (physicalFrame.page[frame] != page)))
+        frame = physicalFrame.hnext[frame];
+    return frame;
+}
+
+// the frame has its pid and page, it is not in the map
+void rmap_add (int frame_index)
+{
+    int pid = physicalFrame.pid[frame_index];
+    int h = rmap_hash (pid, physicalFrame.page[frame_index]);
+
+    physicalFrame.hnext[frame_index] = rmapBucket[h];
+    rmapBucket[h] = frame_index;
+    physicalFrame.prev[frame_index] = NULLINDEX;
+    physicalFrame.next[frame_index] = residentHead[pid];
+    if (residentHead[pid] != NULLINDEX)
+        physicalFrame.prev[residentHead[pid]] = frame_index;
+    residentHead[pid] = frame_index;
+}
+
+// nothing happens if the frame is not in the map
+void rmap_remove (int frame_index)
+{
+    int pid = physicalFrame.pid[frame_index];
+    int page = physicalFrame.page[frame_index];
+    int *link;
+
+    if ((pid < 0) || (pid >= maxProcess) || (page < 0)) return;
+    link = &rmapBucket[rmap_hash (pid, page)];
+    while ((*link != NULLINDEX) && (*link != frame_index))
+        link = &physicalFrame.hnext[*link];
+    if (*link == NULLINDEX) return;
+    *link = physicalFrame.hnext[frame_index];
+    physicalFrame.hnext[frame_index] = NULLINDEX;
+
+    if (physicalFrame.prev[frame_index] != NULLINDEX)
+        physicalFrame.next[physicalFrame.prev[frame_index]] = physicalFrame.next[frame_index];
+    else
+        residentHead[pid] = physicalFrame.next[frame_index];
+    if (physicalFrame.next[frame_index] != NULLINDEX)
+        physicalFrame.prev[physicalFrame.next[frame_index]] = physicalFrame.prev[frame_index];
+    physicalFrame.prev[frame_index] = NULLINDEX;
+    physicalFrame.next[frame_index] = NULLINDEX;
+}
+
+
+// --------------------- //
+// Victim lists          //
+// --------------------- //
+
+// purpose : find the frame to replace without scanning the frame table.
+// A frame in use is in one of 2*ageBits lists, by the level of its age
+// (the highest bit set) and its dirty flag:
+// victimHead, victimTail, physicalFrame.vnext and vprev, physicalFrame.vlist
+// An age scan takes every age one level down; the lists stay as they are,
+// victimShift turns the level each list stands for (victim_rotate). Since
+// the scan shifts all ages of a list alike, a list in age order stays so;
+// victimSorted[list] is cleared when a frame with a lower age than the
+// tail is linked (victim_link), victim_sort puts the list back in order
+// An access (calculate_memory_address, reference_frame, dirty_frame) runs
+// on several cores under the shared lock, it sets dirty without moving the
+// frame, nor does the scan move the frames whose referenced bit it takes
+// into the age. A frame is thus never in a list above the one it belongs
+// in, select_agest_frame moves it up when it comes across it. All are
+// called with memLock held exclusively
+
+// the list the frame belongs in, by its age and dirty flag now
+int victim_list (int frame_index)
+{
+    ageType age = physicalFrame.age[frame_index];
+    int level = 0;
+
+    if (age != 0) level = (ageBits - 1) - __builtin_clz (age);
+    return ((level + victimShift) % ageBits) * 2 + physicalFrame.dirty[frame_index];
+}
+
+// at the tail of its list, the frame is in no list
+void victim_link (int frame_index)
+{
+    int list = victim_list (frame_index);
+
+    if ((victimTail[list] != NULLINDEX)
+        && (physicalFrame.age[frame_index] < physicalFrame.age[victimTail[list]]))
+        victimSorted[list] = 0;
+    physicalFrame.vlist[frame_index] = list;
+    physicalFrame.vnext[frame_index] = NULLINDEX;
+    physicalFrame.vprev[frame_index] = victimTail[list];
+    if (victimTail[list] != NULLINDEX)
+        physicalFrame.vnext[victimTail[list]] = frame_index;
+    else
+        victimHead[list] = frame_index;
+    victimTail[list] = frame_index;
+}
+
+// nothing happens if the frame is in no list
+void victim_unlink (int frame_index)
+{
+    int list = physicalFrame.vlist[frame_index];
+
+    if (list == NULLINDEX) return;
+    if (physicalFrame.vprev[frame_index] != NULLINDEX)
+        physicalFrame.vnext[physicalFrame.vprev[frame_index]] = physicalFrame.vnext[frame_index];
+    else
+        victimHead[list] = physicalFrame.vnext[frame_index];
+    if (physicalFrame.vnext[frame_index] != NULLINDEX)
+        physicalFrame.vprev[physicalFrame.vnext[frame_index]] = physicalFrame.vprev[frame_index];
+    else
+        victimTail[list] = physicalFrame.vprev[frame_index];
+    physicalFrame.vlist[frame_index] = NULLINDEX;
+    if (victimHead[list] == NULLINDEX) victimSorted[list] = 1;
+}
+
+// after an age scan: the lists of level 0 become those of the top level,
+// the frames of level 0 are freed by the scan, those still there were
+// accessed since they were listed and go to the list they belong in
+void victim_rotate ()
+{
+    int slot = victimShift;   // level 0 before the scan
+    int list, frame, next;
+
+    victimShift = (victimShift + 1) % ageBits;
+    for (list = 2 * slot; list <= 2 * slot + 1; list++) {
+        frame = victimHead[list];
+        victimHead[list] = NULLINDEX;
+        victimTail[list] = NULLINDEX;
+        victimSorted[list] = 1;
+        for (; frame != NULLINDEX; frame = next) {
+            next = physicalFrame.vnext[frame];
+            physicalFrame.vlist[frame] = NULLINDEX;
+            victim_link (frame);
+        }
+    }
+}
+
+int compare_victim (const void *a, const void *b)
+{
+    const VictimKey *x = a, *y = b;
+
+    if (x->age != y->age) return (x->age < y->age) ? -1 : 1;
+    return x->seq - y->seq;
+}
+
+// the list in age order, those of the same age as they were listed; a
+// frame that does not belong in the list goes to its own
+void victim_sort (int list)
+{
+    int frame, next, n = 0;
+
+    for (frame = victimHead[list]; frame != NULLINDEX; frame = next) {
+        next = physicalFrame.vnext[frame];
+        if (victim_list (frame) != list) {
+            victim_unlink (frame);
+            victim_link (frame);
+        }
+        else {
+            victimKey[n].age = physicalFrame.age[frame];
+            victimKey[n].seq = n;
+            victimKey[n].frame = frame;
+            n++;
+        }
+    }
+    qsort (victimKey, n, sizeof (VictimKey), compare_victim);
+    for (int i = 0; i < n; i++) {
+        frame = victimKey[i].frame;
+        physicalFrame.vprev[frame] = (i > 0) ? victimKey[i-1].frame : NULLINDEX;
+        physicalFrame.vnext[frame] = (i < n-1) ? victimKey[i+1].frame : NULLINDEX;
+    }
+    if (n > 0) {
+        victimHead[list] = victimKey[0].frame;
+        victimTail[list] = victimKey[n-1].frame;
+    }
+    victimSorted[list] = 1;
+}
+
+
+// --------------------- //
+// Free frame bitmap     //
+// --------------------- //
+
+// purpose : keep the free frames in a bitmap, one bit per frame, with a
+// summary of one bit per bitmap word that has a free frame. Freeing and
+// taking a frame set and clear a bit, the lowest free frame is found by
+// two find-first-set from firstSummary, the first summary word that can
+// be non-zero. All are called with memLock held exclusively
+// (this replaces the free list sorted by index, which was walked on
+// every free and scanned on every take)
+
+void set_free_bit (int frame)
+{
+    int word = frame / bitsPerWord;
+    bitWord bit = 1ULL << (frame % bitsPerWord);
+
+    if (freeMap[word] & bit) return;   // freed twice, e.g. by agescan
+    freeMap[word] |= bit;
+    freeSummary[word / bitsPerWord] |= 1ULL << (word % bitsPerWord);
+    if ((numFreeFrames == 0) || (word / bitsPerWord < firstSummary))
+        firstSummary = word / bitsPerWord;   // the only one, or a lower one
+    numFreeFrames++;
+}
+
+void clear_free_bit (int frame)
+{
+    int word = frame / bitsPerWord;
+    bitWord bit = 1ULL << (frame % bitsPerWord);
+
+    if (!(freeMap[word] & bit)) return;
+    freeMap[word] &= ~bit;
+    if (freeMap[word] == 0)
+        freeSummary[word / bitsPerWord] &= ~(1ULL << (word % bitsPerWord));
+    numFreeFrames--;
+}
+
+// the free frame with the lowest index, NULLINDEX if there is none
+int lowest_free_frame ()
+{
+    int word;
+
+    while ((firstSummary < summaryWords) && (freeSummary[firstSummary] == 0))
+        firstSummary++;
+    if (firstSummary == summaryWords) return NULLINDEX;
+    word = firstSummary * bitsPerWord + __builtin_ctzll (freeSummary[firstSummary]);
+    return word * bitsPerWord + __builtin_ctzll (freeMap[word]);
+}
+
+
 // purspose :
-// get a free frame from the head of the free list
+// get the lowest free frame from the free frame bitmap
 // if there is no free frame, then get one frame with the lowest age
 // this func always returns a frame, either from free list or get one with lowest age
 int get_free_frame ()
 {
   int search_idx;
   int freeframe_idx;
-  freeframe_idx = frameHead;
-  // case 1 : get a free frame from the head of the frame list
-  if (frameHead != NULLINDEX)
+  freeframe_idx = lowest_free_frame ();
+  // case 1 : take the lowest free frame from the bitmap
+  if (freeframe_idx != NULLINDEX)
   {
-      search_idx=frameHead+1;
-      // travser the memory frame to seach for the free frame
-      while ((physicalFrame[search_idx].free == USED_FRAME) && (search_idx <= frameTail))
-      {
-        search_idx++;
-      }
-      // end at the end of the tail
-
-
-      if (search_idx > frameTail)
-      {
-          frameHead = NULLINDEX;
-          frameTail = NULLINDEX;
-      }
-      else
-      {
-        // the free frame is at the search idx
-        frameHead = search_idx;
-      }
+      clear_free_bit (freeframe_idx);
   } // end if
   else
   {
@@ -878,34 +1381,36 @@ int get_free_frame ()
        // implement the select_agest_frame
       freeframe_idx = select_agest_frame ();
   }
+  // the frame is reused, no stale translation may point to it
+  tlb_shootdown_frame (freeframe_idx);
 
 //----------------------------------------------------------------------------------------------//
    // case of dirty frame
-  if (physicalFrame[freeframe_idx].dirty == DIRTY_FRAME)
+  if (physicalFrame.dirty[freeframe_idx] == DIRTY_FRAME)
   {
 
-      unsigned *buf = (unsigned *) malloc (pageSize*sizeof(unsigned));
-      unsigned temp;
+      mwordType *buf = (mwordType *) malloc (pageSize*sizeof(mwordType));
+      mwordType temp;
 
       // search through the page
       for (search_idx=0; search_idx<pageSize; search_idx++)
       {
-          temp = (unsigned)Memory[freeframe_idx*pageSize+search_idx].mInstr;
+          temp = Memory[freeframe_idx*pageSize+search_idx].mInstr;
           buf[search_idx] = temp;
       }
       // first we have to get the data from the dirry frame
-      insert_swapQ(physicalFrame[freeframe_idx].pid,physicalFrame[freeframe_idx].page,buf,actWrite,Nothing);
+      insert_swapQ(physicalFrame.pid[freeframe_idx],physicalFrame.page[freeframe_idx],buf,actWrite,Nothing);
       // then update the page table with
-      update_process_pagetable (physicalFrame[freeframe_idx].pid, physicalFrame[freeframe_idx].page, DISKPAGE);
+      update_process_pagetable (physicalFrame.pid[freeframe_idx], physicalFrame.page[freeframe_idx], DISKPAGE);
   }
 
   //----------------------------------------------------------------------------------------------//
 
-  if (physicalFrame[freeframe_idx].pid != NULLINDEX)
+  if (physicalFrame.pid[freeframe_idx] != NULLINDEX)
   {
      //updates page table
      // with
-      update_process_pagetable (physicalFrame[freeframe_idx].pid, physicalFrame[freeframe_idx].page, DISKPAGE);
+      update_process_pagetable (physicalFrame.pid[freeframe_idx], physicalFrame.page[freeframe_idx], DISKPAGE);
   }
 
   return freeframe_idx;
@@ -916,35 +1421,31 @@ int get_free_frame ()
 // select a frame with the lowest age
 // if there are multiple frames with the same lowest age, then choose the one
 // that is not dirty
+// the lowest non-empty level holds the lowest age; its clean list and its
+// dirty one are put in age order if they are not (victim_sort), the lower
+// of their first frames is taken, the clean one on a tie. A frame that was
+// accessed since it was listed is moved to its list on the way, see
+// victim_list
 int select_agest_frame ()
 {
-   // low age is the highest age that we have
-    int lowAge = AGEMAX;
-    int frame;
-    int agest_frame = NULLPAGE;
-
-
-    // traverse to the total of the frame
-    for(frame=OSpages; frame<numFrames; frame++)
-  {
-      // if it is not free frame
-        if (physicalFrame[frame].free != FREE_FRAME)
-      {
-        if ((physicalFrame[frame].dirty == CLEAN_FRAME) && (physicalFrame[frame].age == lowAge))
-        {
-            agest_frame = frame;
-        } // end inner if
-        else if (physicalFrame[frame].age < lowAge)
-        {
-            lowAge = physicalFrame[frame].age;
-            // update the agest frame
-            agest_frame = frame;
-        } // end inner else if
-
-      } // end if
-    } // end for
-    return agest_frame;
-
+    int level, slot, list, frame, best;
+
+    for (level = 0; level < ageBits; level++) {
+        slot = (level + victimShift) % ageBits;
+        best = NULLINDEX;
+        for (list = 2 * slot; list <= 2 * slot + 1; list++) {
+            if (!victimSorted[list]) victim_sort (list);
+            while (((frame = victimHead[list]) != NULLINDEX) && (victim_list (frame) != list)) {
+                victim_unlink (frame);
+                victim_link (frame);   // to a higher level, or to dirty
+            }
+            if ((frame != NULLINDEX)
+                && ((best == NULLINDEX) || (physicalFrame.age[frame] < physicalFrame.age[best])))
+                best = frame;
+        }
+        if (best != NULLINDEX) return best;
+    }
+    return NULLINDEX;
 }
 
 
@@ -953,7 +1454,7 @@ int select_agest_frame ()
 // Helper Method for loader.c
 
 
-void direct_put_instruction (int frame_index, int offset, int instruction)
+void direct_put_instruction (int frame_index, int offset, mwordType instruction)
 {
   int address = (offset & pageoffsetMask) | (frame_index << pagenumShift);
   Memory[address].mInstr = instruction;
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "simos.h"
+
+//=========================================================================
+// Run-ahead prefetch
+// When the running process takes a page fault, page_fault_handler
+//    (paging.c) queues the read of the missing page and calls run_ahead,
+//    which goes on decoding the instruction stream of the process past
+//    the fault on shadow registers; nothing is committed, neither to the
+//    CPU registers nor to memory, no frame is referenced
+// Every disk page it would touch gets a prefetch read in the swap queue
+//    (prefetch_page, paging.c), at most runAhead of them per fault, so
+//    the serial faults of a data-walking loop become queued reads
+// A value that depends on a page that is not in memory is unknown.
+//    Stores go to a small store buffer, so a later load sees them (e.g.
+//    the pointer K that prog-sum advances and loads indirectly)
+// A branch on an unknown value falls through, which leaves an inner
+//    loop waiting on the missing data; print and sleep are skipped;
+//    exit, vector instructions and an unknown address end the run
+//=========================================================================
+
+#define runAheadLimit 256   // max #instructions decoded past a fault
+#define storeBufSize 16     // stores remembered by the run
+
+typedef struct
+{ int offset;
+  mdType value;
+  int known;
+} typeShadowStore;
+
+typeShadowStore storeBuf[storeBufSize];
+int numStores, numFetched;
+     // only used by the page fault handler, which holds memLock exclusively
+
+// memory address of offset of pid, -1 if its page is not in memory
+// a disk page is prefetched on the way, as long as the limit allows
+int shadow_address (int pid, int offset)
+{ int page, frame;
+
+  if (offset < 0) return (-1);
+  page = offset / pageSize;
+  if (page >= maxPpages) return (-1);
+  frame = PCB[pid]->PTptr[page];
+  if (frame >= 0) return (frame*pageSize + offset%pageSize);
+  if (numFetched < runAhead && prefetch_page (pid, page)) numFetched++;
+    // a pending page is already being read, a null page has no content
+  return (-1);
+}
+
+// value of the data at offset, the latest store of the run first
+// returns 1 if the value is known
+int shadow_load (int pid, int offset, mdType *value)
+{ int i, maddr;
+
+  for (i=numStores-1; i>=0; i--)
+    if (storeBuf[i].offset == offset)
+    { *value = storeBuf[i].value;
+      return (storeBuf[i].known);
+    }
+  maddr = shadow_address (pid, offset);
+  if (maddr < 0) return (0);
+  *value = Memory[maddr].mData;
+  return (1);
+}
+
+void shadow_store (int pid, int offset, mdType value, int known)
+{ int i;
+
+  shadow_address (pid, offset);   // the page is needed for the store
+  if (numStores == storeBufSize)   // drop the oldest
+  { for (i=1; i<storeBufSize; i++) storeBuf[i-1] = storeBuf[i];
+    numStores--;
+  }
+  storeBuf[numStores].offset = offset;
+  storeBuf[numStores].value = value;
+  storeBuf[numStores].known = known;
+  numStores++;
+}
+
+// the process is at CPU.PC, the faulting instruction, which is decoded
+// again: its missing data simply comes out unknown
+void run_ahead (int pid)
+{ mwordType instr;
+  mdType AC, MBR;
+  int PC, n, maddr, opcode, operand, acKnown, mbrKnown, running;
+
+  if (runAhead <= 0) return;
+  numStores = 0; numFetched = 0;
+  PC = CPU.PC; AC = CPU.AC; acKnown = 1; running = 1;
+  for (n=0; running && n<runAheadLimit && numFetched<runAhead; n++)
+  { maddr = shadow_address (pid, PC);
+    if (maddr < 0) break;   // code page is not in, prefetched if on disk
+    instr = Memory[maddr].mInstr;
+    opcode = instr >> opcodeShift;
+    operand = instr & operandMask;
+    switch (opcode)
+    { case OPload:
+        acKnown = shadow_load (pid, operand, &AC);
+        PC++; break;
+      case OPload2:   // indirect, the address has to be known
+        if (!shadow_load (pid, operand, &MBR)) { running = 0; break; }
+        acKnown = shadow_load (pid, (int) MBR, &AC);
+        PC++; break;
+      case OPadd:
+        mbrKnown = shadow_load (pid, operand, &MBR);
+        AC = AC + MBR; acKnown = acKnown && mbrKnown;
+        PC++; break;
+      case OPmul:
+        mbrKnown = shadow_load (pid, operand, &MBR);
+        AC = AC * MBR; acKnown = acKnown && mbrKnown;
+        PC++; break;
+      case OPstore:
+        shadow_store (pid, operand, AC, acKnown);
+        PC++; break;
+      case OPifgo:   // the goto address is in the second word
+        mbrKnown = shadow_load (pid, operand, &MBR);
+        maddr = shadow_address (pid, PC+1);
+        if (maddr < 0) { running = 0; break; }
+        if (mbrKnown && MBR > 0) PC = Memory[maddr].mInstr & operandMask;
+        else PC = PC + 2;
+        break;
+      case OPprint:   // the printed data may be on disk
+        shadow_load (pid, operand, &MBR);
+        PC++; break;
+      case OPsleep:
+        PC++; break;
+      default:   // exit, vector instructions
+        running = 0;
+    }
+  }
+  if (memDebug)
+    fprintf (bugF, "Run-ahead of process %d: %d instructions, %d prefetches\n",
+             pid, n, numFetched);
+}
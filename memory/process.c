@@ -1,5 +1,6 @@
 #include <pthread.h>
 #include <semaphore.h>
+#include <string.h>
 #include "simos.h"
 
 
@@ -9,18 +10,23 @@ int numUserProcess = 0;
 // context switch, switch in or out a process pid
 //============================================
 
+// each costs osCost[osSwitch] cycles, see charge_os in clock.c
 void context_in (int pid)
-{ CPU.Pid = pid;
+{ charge_os (osSwitch);
+  CPU.Pid = pid;
   CPU.PC = PCB[pid]->PC;
   CPU.AC = PCB[pid]->AC;
   CPU.PTptr = PCB[pid]->PTptr;
   CPU.exeStatus = PCB[pid]->exeStatus;
+  CPU.VIndex = PCB[pid]->VIndex;
 }
 
 void context_out (int pid)
-{ PCB[pid]->PC = CPU.PC;
+{ charge_os (osSwitch);
+  PCB[pid]->PC = CPU.PC;
   PCB[pid]->AC = CPU.AC;
   PCB[pid]->exeStatus = CPU.exeStatus;
+  PCB[pid]->VIndex = CPU.VIndex;
 }
 
 //=========================================================================
@@ -28,27 +34,30 @@ void context_out (int pid)
 // Implemented as a linked list with head and tail pointers
 // The ready queue needs to be protected in case insertion comes from
 // process submission and removal from process execution
+// Each core has its own MLFQ (4 levels) protected by its own mutex
+//   a ready process goes to the core it last ran on (coreAffinity = 1)
+//   or to the core with the fewest ready processes
+//   a core whose queues are empty steals the first process of the highest
+//   level of another core before it runs the idle process
 //=========================================================================
 
 #define nullReady 0
    // when get_ready_process encoutered empty queue, nullReady is returned
+#define numLevels 4   // priority 1 .. 4
 
 typedef struct ReadyNodeStruct
 { int pid;
   struct ReadyNodeStruct *next;
 } ReadyNode;
 
-ReadyNode *readyHead = NULL;
-ReadyNode *readyTail = NULL;
+typedef struct
+{ ReadyNode *head[numLevels], *tail[numLevels];   // level = priority-1
+  int count;    // #processes in the queues, read without the mutex as a hint
+  int steals;   // #processes this core took from other cores
+  sem_t mutex;
+} ReadyQueue;
 
-ReadyNode *readyHead2 = NULL;
-ReadyNode *readyTail2 = NULL;
-
-ReadyNode *readyHead3 = NULL;
-ReadyNode *readyTail3 = NULL;
-
-ReadyNode *readyHead4 = NULL;
-ReadyNode *readyTail4 = NULL;
+ReadyQueue *readyQ;   // one for each core
 
 void addToQueue(ReadyNode** tail, ReadyNode** head, int pid){
     ReadyNode *node;
@@ -80,34 +89,49 @@ void displayReadyQueue(ReadyNode** head, FILE *outf){
 
 
 		  }
-void insert_ready_process (int pid)
-{
-switch(PCB[pid]->priority){
+// put pid in the queue of its priority, caller holds q->mutex
+void insert_queue(ReadyQueue *q, int pid){
+  int level = PCB[pid]->priority - 1;
+  addToQueue(&q->tail[level], &q->head[level], pid);
+}
 
+int select_core (int pid)
+{ int k, core;
 
-  case 1:
-        addToQueue(&readyTail, &readyHead, pid);
-break;
-case 2:
-      addToQueue(&readyTail2, &readyHead2, pid);
-break;
- case 3:
-      addToQueue(&readyTail3, &readyHead3, pid);
-break;
-  case 4:
-  addToQueue(&readyTail4, &readyHead4, pid);
-				  break;}
+  if (coreAffinity && PCB[pid]->core != nullCore) return (PCB[pid]->core);
+  core = 0;
+  for (k=1; k<numCores; k++)
+    if (readyQ[k].count < readyQ[core].count) core = k;
+  return (core);
 }
 
+void insert_ready_process (int pid)
+{ ReadyQueue *q;
+
+  account_state (pid, rsReady);
+  q = &readyQ[select_core (pid)];
+  sem_wait (&q->mutex);
+  insert_queue (q, pid);
+  q->count++;
+  sem_post (&q->mutex);
+}
+
+// the burst of pid is waiting time for the processes in the queues of
+// its core (waitingTime is reset when a process is queued)
 void waitingTimeUpdate(int pid){
-int i =2;
-for(i;i<=currentPid-1;i++){
-if(PCB[i]!=NULL){
-PCB[i]->waitingTime += PCB[pid]->burstTime;
+ReadyQueue *q = &readyQ[CPU.coreId];
+ReadyNode *node;
+int level;
+sem_wait (&q->mutex);
+for(level=0;level<numLevels;level++){
+for(node=q->head[level];node!=NULL;node=node->next){
+PCB[node->pid]->waitingTime += PCB[pid]->burstTime;
+}
+}
+sem_post (&q->mutex);
 }
-}}
 
-void waitingTime(ReadyNode** head, ReadyNode** tail){
+void waitingTime(ReadyQueue *q, ReadyNode** head, ReadyNode** tail){
 
 ReadyNode *nodeh = *head;
 ReadyNode *prev = *head;
@@ -120,7 +144,7 @@ int i = nodeh->pid;
 *head = nodeh->next;
 if(*head==NULL){*tail=NULL;}
 free(nodeh);
-insert_ready_process(i);
+insert_queue(q, i);
 printf("\n");
 return;
 }
@@ -139,91 +163,92 @@ int i = nodeh->pid;
 if(nodeh->pid == prev->pid&& prev->next==NULL){
 *head=NULL;
 *tail=NULL;
-insert_ready_process(i);
+insert_queue(q, i);
 return ;
 }else if(nodeh->pid==prev->pid && nodeh->next->pid == prev->next->pid){
 *head = nodeh -> next;
-insert_ready_process(i);
+insert_queue(q, i);
 }else{prev->next=nodeh->next;
 if(prev->next==NULL){ *tail=prev;}
 free(nodeh);
-insert_ready_process(i);
+insert_queue(q, i);
 return;
 }
 }
 
-int get_ready_process ()
-{ ReadyNode *rnode;
-  int pid, A, B, C,D;
-  if(readyHead== NULL){
-  A=0;
-  }else{A=1;}
-  if(readyHead2== NULL){
-    B=0;
-      }else{B=1;}
-  if(readyHead3== NULL){
-    C=0;
-      }else{C=1;}
-      if(readyHead4== NULL){
-        D=0;
-	  }else{D=1;}
-if(A ==1){
+// remove the first process of the highest non-empty level of q
+// caller holds q->mutex
+int take_ready_process (ReadyQueue *q)
+{ int pid, level;
+
+  for (level=0; level<numLevels; level++)
+    if (q->head[level] != NULL)
+    { pid = getHead (&q->head[level]);
+      if (q->head[level] == NULL) q->tail[level] = NULL;
+      q->count--;
+      return (pid);
+    }
+  return (nullReady);
+}
 
+// work stealing: look at the other cores, starting from the next one
+int steal_ready_process ()
+{ ReadyQueue *q;
+  int k, pid;
+
+  for (k=1; k<numCores; k++)
+  { q = &readyQ[(CPU.coreId + k) % numCores];
+    if (q->count == 0) continue;
+    sem_wait (&q->mutex);
+    pid = take_ready_process (q);
+    sem_post (&q->mutex);
+    if (pid != nullReady)
+    { readyQ[CPU.coreId].steals++;
+      return (pid);
+    }
+  }
+  return (nullReady);
+}
 
-{
-    pid = getHead(&readyHead);
-   if(readyHead==NULL){readyTail=NULL;}
-     waitingTime(&readyHead2, &readyTail2);
-   waitingTime(&readyHead3, &readyTail3);
-waitingTime(&readyHead4, &readyTail4);
+int get_ready_process ()
+{ ReadyQueue *q = &readyQ[CPU.coreId];
+  int pid, level;
 
-}
+  sem_wait (&q->mutex);
+  pid = take_ready_process (q);
+  if (pid != nullReady)
+    for (level=1; level<numLevels; level++)
+      waitingTime (q, &q->head[level], &q->tail[level]);
+  sem_post (&q->mutex);
+  if (pid == nullReady && numCores > 1) pid = steal_ready_process ();
   return (pid);
-}else if(B ==1){
-
-	{ pid = getHead(&readyHead2);
-
-			if (readyHead2 == NULL) {readyTail2 = NULL;}
-			waitingTime(&readyHead2, &readyTail2);
-			waitingTime(&readyHead3, &readyTail3);
-            waitingTime(&readyHead4, &readyTail4);
-	}
-			        return (pid);
-
-} else if(C ==1){
-	 { pid = getHead(&readyHead3);
-		    if (readyHead3 == NULL){readyTail3 = NULL;}
-		    waitingTime(&readyHead2, &readyTail2);
-		    waitingTime(&readyHead3, &readyTail3);
-		    waitingTime(&readyHead4, &readyTail4);
-	}
-			        return (pid);
-} else if(D ==1){
-	 { pid = getHead(&readyHead4);
-		    if (readyHead4 == NULL) {readyTail4 = NULL;}
-		     waitingTime(&readyHead2, &readyTail2);
-		     waitingTime(&readyHead3, &readyTail3);
-	        waitingTime(&readyHead4, &readyTail4);
-	}
-			       return (pid);
-
 }
+
+void initialize_ready_queues ()
+{ int k, level;
+
+  readyQ = (ReadyQueue *) malloc (numCores*sizeof(ReadyQueue));
+  for (k=0; k<numCores; k++)
+  { for (level=0; level<numLevels; level++)
+    { readyQ[k].head[level] = NULL; readyQ[k].tail[level] = NULL; }
+    readyQ[k].count = 0;
+    readyQ[k].steals = 0;
+    sem_init (&readyQ[k].mutex, 0, 1);
+  }
 }
+
 void dump_MLFQ (FILE *outf)
-{
+{ int k, level;
+
 fprintf (outf, "******************** Ready Queue Dump\n");
-printf("RQ1:");
-displayReadyQueue(&readyHead, outf);
+for (k=0; k<numCores; k++){
+if (numCores > 1) fprintf (outf, "Core %d (steals=%d):\n", k, readyQ[k].steals);
+for (level=0; level<numLevels; level++){
+fprintf (outf, "RQ%d:", level+1);
+displayReadyQueue(&readyQ[k].head[level], outf);
 fprintf (outf,"\n");
-printf("RQ2:");
-displayReadyQueue(&readyHead2, outf);
-fprintf (outf,"\n");
-printf("RQ3:");
-displayReadyQueue(&readyHead3, outf);
-fprintf (outf,"\n");
-printf("RQ4:");
-displayReadyQueue(&readyHead4, outf);
-fprintf(outf,"\n");
+}
+}
 }
 
 
@@ -298,7 +323,7 @@ void init_PCB_ptrarry ()
 { PCB = (typePCB **) malloc (maxProcess*addrSize); }
 
 int new_PCB ()
-{ int pid;
+{ int pid, i;
 
   pid = currentPid;
   currentPid++;
@@ -313,6 +338,24 @@ int new_PCB ()
   PCB[pid]->timeUsed = 0;
   PCB[pid]->numPF = 0;
   PCB[pid]->priority =1;
+  PCB[pid]->numInstr = 0;
+  PCB[pid]->numFused = 0;
+  PCB[pid]->VIndex = 0;
+  PCB[pid]->core = nullCore;
+  PCB[pid]->pfWaitPage = nullWait;
+  PCB[pid]->numPrefetch = 0;
+  PCB[pid]->osTime = 0;
+  PCB[pid]->rState = rsReady;   // until it is loaded, see account_state
+  PCB[pid]->rSince = CPU.numCycles;
+  for (i=0; i<numRStates; i++) PCB[pid]->rCycles[i] = 0;
+  PCB[pid]->numDispatch = 0;
+  PCB[pid]->numPreempt = 0;
+  PCB[pid]->pagesRead = 0;
+  PCB[pid]->pagesWritten = 0;
+  PCB[pid]->residentPages = 0;
+  PCB[pid]->peakResident = 0;
+  PCB[pid]->swapPages = 0;
+  PCB[pid]->peakSwap = 0;
   return (pid);
 }
 
@@ -332,6 +375,60 @@ void dump_PCB (FILE *outf, int pid)
   fprintf (outf, "PTptr = %x\n", PCB[pid]->PTptr);
   fprintf (outf, "exeStatus = %d\n", PCB[pid]->exeStatus);
   fprintf (outf, "Priority = %d\n", PCB[pid]->priority);
+  fprintf (outf, "numPF = %d, numPrefetch = %d\n",
+           PCB[pid]->numPF, PCB[pid]->numPrefetch);
+  fprintf (outf, "timeUsed = %d, osTime = %d\n",
+           PCB[pid]->timeUsed, PCB[pid]->osTime);
+  dump_rusage (outf, pid);
+}
+
+//=========================================================================
+// resource usage of each process
+// The cycles of a process go to the state it is in: run, ready, page
+// fault wait, terminal wait, sleep. The state is changed where the
+// process gets there: execute_process (run), insert_ready_process
+// (ready), page_fault_handler (page fault), insert_termIO (output) and
+// the sleep instruction, the cycles since the last change are added to
+// the old state. The clock is that of the calling core; a process
+// that changes core may see a slower clock, then nothing is added
+// The page counts are kept by update_process_pagetable (paging.c), the
+// swap requests by insert_swapQ (swap.c)
+//=========================================================================
+
+void account_state (int pid, int state)
+{ int now;
+
+  if (PCB[pid] == NULL) return;
+  now = CPU.numCycles;
+  if (now > PCB[pid]->rSince)
+    PCB[pid]->rCycles[PCB[pid]->rState] += now - PCB[pid]->rSince;
+  PCB[pid]->rState = state;
+  PCB[pid]->rSince = now;
+}
+
+void dump_rusage (FILE *outf, int pid)
+{ typePCB *p;
+
+  p = PCB[pid];
+  fprintf (outf, "Process %d usage: run=%d, ready=%d, pfwait=%d, ", pid,
+           p->rCycles[rsRun], p->rCycles[rsReady], p->rCycles[rsPFWait]);
+  fprintf (outf, "termwait=%d, sleep=%d cycles, os=%d\n",
+           p->rCycles[rsTermWait], p->rCycles[rsSleep], p->osTime);
+  fprintf (outf, "  dispatched=%d, preempted=%d, pages read=%d, written=%d, ",
+           p->numDispatch, p->numPreempt, p->pagesRead, p->pagesWritten);
+  fprintf (outf, "resident=%d (peak %d), swap slots=%d (peak %d)\n",
+           p->residentPages, p->peakResident, p->swapPages, p->peakSwap);
+}
+
+void dump_rusage_list (FILE *outf)
+{ int pid;
+
+  fprintf (outf, "******************** Process Usage Dump\n");
+  for (pid=idlePid+1; pid<currentPid && pid<maxProcess; pid++)
+    if (PCB[pid] != NULL)
+    { account_state (pid, PCB[pid]->rState);   // up to now
+      dump_rusage (outf, pid);
+    }
 }
 
 void dump_PCB_list (FILE *outf)
@@ -353,6 +450,15 @@ void dump_PCB_memory (FILE *outf)
 }
 
 
+void dump_PCB_fusion (FILE *outf)
+{ int pid;
+
+  fprintf (outf, "Superinstruction coverage: From 2 to %d\n", currentPid-1);
+  for (pid=idlePid+1; pid<currentPid; pid++)
+    if (PCB[pid] != NULL) dump_fusion (outf, pid);
+}
+
+
 //=========================================================================
 // process management
 //=========================================================================
@@ -382,12 +488,17 @@ void exiting_process (int pid)
              pid, PCB[pid]->timeUsed, PCB[pid]->numPF);
     sprintf (str, "Process %d had completed successfully: Time=%d, PF=%d\n",
              pid, PCB[pid]->timeUsed, PCB[pid]->numPF);
+    if (PCB[pid]->numInstr > 0) dump_fusion (infF, pid);
+      // ran on the threaded engine, report superinstruction coverage
+    if (cacheModel) dump_cache_process (infF, pid);
+    account_state (pid, rsRun);   // the last run, up to now
+    dump_rusage (infF, pid);
   }
   insert_termIO (pid, str, exitProgIO);
 
   // invoke io to print str, process has terminated, so no wait state
 
-  numUserProcess--;
+  __sync_fetch_and_sub (&numUserProcess, 1);   // cores exit in parallel
   clean_process (pid);
     // cpu will clean up process pid without waiting for printing to finish
     // so, io should not access PCB[pid] for end process printing
@@ -401,9 +512,107 @@ void initialize_process_manager ()
   numUserProcess = 0;  // the actual number of processes in the system
 
   init_idle_process ();
+  initialize_ready_queues ();
   sem_init (&pmutex, 0, 1);
 }
 
+//================================================================
+// checkpoint (checkpoint.c): the PCBs with their page tables, the ready
+// queues of every core and the endIO list, as pids in queue order
+// on restore, the processes of the running system are dropped, the idle
+// process keeps its PCB and page table, which are overwritten
+//================================================================
+
+void save_pid_list (ReadyNode *node)
+{ int n;
+  ReadyNode *p;
+
+  for (n=0, p=node; p!=NULL; p=p->next) n++;
+  ckpt_write_int (n);
+  for (p=node; p!=NULL; p=p->next) ckpt_write_int (p->pid);
+}
+
+void checkpoint_processes ()
+{ EndIOnode *node;
+  int pid, k, level, n;
+
+  ckpt_write_int (currentPid);
+  ckpt_write_int (numUserProcess);
+  for (pid=idlePid; pid<currentPid && pid<maxProcess; pid++)
+    if (PCB[pid] != NULL)
+    { ckpt_write_int (pid);
+      ckpt_write (PCB[pid], sizeof(typePCB));
+      ckpt_write (PCB[pid]->PTptr, maxPpages*addrSize);
+    }
+  ckpt_write_int (nullPid);
+  for (k=0; k<numCores; k++)
+  { ckpt_write_int (readyQ[k].count);
+    ckpt_write_int (readyQ[k].steals);
+    for (level=0; level<numLevels; level++)
+      save_pid_list (readyQ[k].head[level]);
+  }
+  for (n=0, node=endIOhead; node!=NULL; node=node->next) n++;
+  ckpt_write_int (n);
+  for (node=endIOhead; node!=NULL; node=node->next) ckpt_write_int (node->pid);
+}
+
+void restore_pid_list (ReadyNode **head, ReadyNode **tail)
+{ ReadyNode *node;
+  int n;
+
+  while (*head != NULL) { node = *head; *head = node->next; free (node); }
+  *tail = NULL;
+  for (n = ckpt_read_int (); n > 0; n--)
+  { node = (ReadyNode *) malloc (sizeof (ReadyNode));
+    node->pid = ckpt_read_int ();
+    node->next = NULL;
+    if (*tail == NULL) *head = node; else (*tail)->next = node;
+    *tail = node;
+  }
+}
+
+void restore_processes ()
+{ EndIOnode *node;
+  int pid, k, level, n, *PTptr;
+
+  for (pid=idlePid+1; pid<currentPid && pid<maxProcess; pid++)
+    if (PCB[pid] != NULL)
+    { icache_free_process (pid);
+      free (PCB[pid]->PTptr); free (PCB[pid]);
+      PCB[pid] = NULL;
+    }
+  currentPid = ckpt_read_int ();
+  numUserProcess = ckpt_read_int ();
+  for (pid=idlePid+1; pid<currentPid && pid<maxProcess; pid++)
+    PCB[pid] = NULL;
+  while ((pid = ckpt_read_int ()) != nullPid)
+  { if (pid == idlePid) PTptr = PCB[pid]->PTptr;
+    else
+    { PCB[pid] = (typePCB *) malloc (sizeof(typePCB));
+      PTptr = (int *) malloc (addrSize*maxPpages);
+    }
+    memcpy (PCB[pid], ckpt_read (sizeof(typePCB)), sizeof(typePCB));
+    memcpy (PTptr, ckpt_read (maxPpages*addrSize), maxPpages*addrSize);
+    PCB[pid]->PTptr = PTptr;
+  }
+  for (k=0; k<numCores; k++)
+  { readyQ[k].count = ckpt_read_int ();
+    readyQ[k].steals = ckpt_read_int ();
+    for (level=0; level<numLevels; level++)
+      restore_pid_list (&readyQ[k].head[level], &readyQ[k].tail[level]);
+  }
+  while (endIOhead != NULL)
+  { node = endIOhead; endIOhead = node->next; free (node); }
+  endIOtail = NULL;
+  for (n = ckpt_read_int (); n > 0; n--)
+  { node = (EndIOnode *) malloc (sizeof (EndIOnode));
+    node->pid = ckpt_read_int ();
+    node->next = NULL;
+    if (endIOtail == NULL) endIOhead = node; else endIOtail->next = node;
+    endIOtail = node;
+  }
+}
+
 //================================================================
 // submit_process always works on a new pid and the new pid will not be
 // used by anyone else till submit_process finishes working on it
@@ -416,6 +625,7 @@ void initialize_process_manager ()
 int submit_process (char *fname)
 { int pid, ret, i;
 
+  if (traceMode == traceRecord) trace_submit (fname);
   // if there are too many processes s.t. each cannot get sufficient memory
   // then reject the process
   if ( ((numFrames-OSpages)/(numUserProcess+1)) < 2 )
@@ -424,7 +634,9 @@ int submit_process (char *fname)
   else
   { pid = new_PCB ();
     if (pid > idlePid)
-    { ret = load_process (pid, fname);   // return #pages loaded
+    { memory_lock_exclusive ();   // the loader sets up frames, page table
+      ret = load_process (pid, fname);   // return #pages loaded
+      memory_unlock ();
       if (ret > 0)  // loaded successfully
       { PCB[pid]->PC = 0;
         PCB[pid]->AC = 0;
@@ -432,7 +644,7 @@ int submit_process (char *fname)
         // swap manager will put the process to endIO list and then
         // process.c will eventually move it to ready queue
         // at this point, the process may not be loaded yet, but no problem
-        numUserProcess++;
+        __sync_fetch_and_add (&numUserProcess, 1);
         return (pid);  // the only case of successful process creation
       }
       // else new_PCB returned -1, PCB has not been created
@@ -452,12 +664,13 @@ int submit_process (char *fname)
 //================================================================
 
 void execute_process ()
-{ int pid, intime;
+{ int pid, intime, ostime;
   genericPtr event;
 //waitingTimeUpdate();
 //waitingTime(&readyHead2, &readyTail);
 //waitingTime(&readyHead3, &readyTail2);
 //waitingTime(&readyHead4, &readyTail3);
+  if (traceMode == traceReplay) trace_round ();   // submissions
  pid = get_ready_process ();
   if (pid != nullReady)
     // execute the ready process (with pid# = pid)
@@ -466,22 +679,34 @@ void execute_process ()
     //   (2) set execution status + check status to do subsequent actions
     //   (3) set timer to stop execution at the time quantum
     //   (4) accounting: add execution time to PCB[?]->timeUsed,
-  { context_in (pid);   // === (1)
+    //       the OS overhead (charge_os) of the round to PCB[?]->osTime
+  { intime = CPU.numCycles;   // ===(4)
+    ostime = CPU.osTime;
+    context_in (pid);   // === (1)
+    account_state (pid, rsRun);
+    PCB[pid]->numDispatch++;
+    if (traceMode) trace_schedule_in (pid);
+    PCB[pid]->core = CPU.coreId;
     CPU.exeStatus = eRun;   // === (2)
-    intime = CPU.numCycles;   // ===(4)
     event = add_timer (cpuQuantum*PCB[pid]->priority, CPU.Pid,  // == (3)
                        actTQinterrupt, oneTimeTimer);
     cpu_execution ();
+    if (traceMode) trace_schedule_out (CPU.exeStatus);
     context_out (pid);  // === (1)
         PCB[pid]->burstTime = CPU.numCycles - intime;
 	waitingTimeUpdate(pid);
-    PCB[pid]->timeUsed += (CPU.numCycles - intime);// ===(4)
+    ostime = CPU.osTime - ostime;
+    PCB[pid]->osTime += ostime;
+    PCB[pid]->timeUsed += (CPU.numCycles - intime) - ostime;// ===(4)
      if(PCB[pid]->burstTime < cpuQuantum*PCB[pid]->priority || PCB[pid]->priority==4){
          PCB[pid]->priority = PCB[pid]->priority;
 	     }else{
 	         PCB[pid]->priority =  PCB[pid]->priority + 1;
 		     }
-    if (CPU.exeStatus == eReady) insert_ready_process (pid);  // === (2)
+    if (CPU.exeStatus == eReady)   // === (2)
+    { PCB[pid]->numPreempt++;
+      insert_ready_process (pid);
+    }
     else if (CPU.exeStatus == ePFault || CPU.exeStatus == eWait)
       // eWait: should have been handled by instruction execution
       // ePFault: calculate_memory_address should have set pFaultException,
@@ -498,7 +723,73 @@ void execute_process ()
     //   No problem! eReady is only set upon tqInterrupt (in cpu.c)
     //    if the process had ePFault/eWait, it will not be set to eReady
   }
-  else execute_idle_process ();
+  else
+  { if (traceMode) trace_schedule_in (idlePid);
+    ostime = CPU.osTime;
+    execute_idle_process ();
+    PCB[idlePid]->osTime += CPU.osTime - ostime;
+  }
     // no ready process in the system, so execute idle process
     // ===== see https://en.wikipedia.org/wiki/System_Idle_Process
 }
+
+//================================================================
+// multi-core execution
+// core 0 runs on the main thread (admin commands), every other core
+// has a host thread which waits for admin to hand out rounds
+// execute_rounds runs #rounds of execute_process on each core in
+// parallel and returns when all the cores are done
+//================================================================
+
+sem_t *coreStart, *coreDone;   // for each core > 0
+int *coreRounds;
+pthread_t *coreThread;
+
+void *core_execution (void *arg)
+{ int core, i;
+
+  core = (int) (long) arg;
+  bind_core (core);
+  while (1)
+  { sem_wait (&coreStart[core]);
+    if (!systemActive) break;
+    for (i=0; i<coreRounds[core]; i++) execute_process ();
+    sem_post (&coreDone[core]);
+  }
+  if (cpuDebug) fprintf (bugF, "Core %d has ended\n", core);
+  return (NULL);
+}
+
+void execute_rounds (int rounds)
+{ int k, i;
+
+  for (k=1; k<numCores; k++)
+  { coreRounds[k] = rounds; sem_post (&coreStart[k]); }
+  for (i=0; i<rounds; i++) execute_process ();   // boot core
+  for (k=1; k<numCores; k++) sem_wait (&coreDone[k]);
+}
+
+void start_cores ()
+{ int k, ret;
+
+  coreStart = (sem_t *) malloc (numCores*sizeof(sem_t));
+  coreDone = (sem_t *) malloc (numCores*sizeof(sem_t));
+  coreRounds = (int *) malloc (numCores*sizeof(int));
+  coreThread = (pthread_t *) malloc (numCores*sizeof(pthread_t));
+  for (k=1; k<numCores; k++)
+  { sem_init (&coreStart[k], 0, 0);
+    sem_init (&coreDone[k], 0, 0);
+    ret = pthread_create (&coreThread[k], NULL, core_execution,
+                          (void *) (long) k);
+    if (ret != 0) { printf ("Error in Core %d Thread Creation\n", k); exit (-1); }
+  }
+  if (numCores > 1) printf ("%d cores are running\n", numCores);
+}
+
+// systemActive is 0, the cores are waiting for rounds, let them exit
+void end_cores ()
+{ int k;
+
+  for (k=1; k<numCores; k++) sem_post (&coreStart[k]);
+  for (k=1; k<numCores; k++) pthread_join (coreThread[k], NULL);
+}
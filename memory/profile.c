@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "simos.h"
+
+//=========================================================================
+// Execution profiler for simulated programs
+// When profileOn is set (admin command o), cpu.c runs the switch engine
+//    and reports every instruction cycle here: the cycle is counted for
+//    its opcode and its (pid, PC), or as a page fault of that PC
+// When profileOn is 0 the only cost is one test per instruction in the
+//    switch engine, the threaded and jit engines are not touched
+// Admin command g prints the profile and writes it as folded stacks
+//    (pid;page;pc_opcode count), which flamegraph tools read directly
+//=========================================================================
+
+#define profileFname "profile.folded"
+#define numProfOPcode 16   // opcodes 0 .. OPmemset, see cpu.c
+
+char *profOPname[numProfOPcode] =
+  { "op0", "exit", "load", "add", "mul", "ifgo", "store", "print",
+    "sleep", "load2", "vadd", "vmul", "vsum", "vscale", "memcpy",
+    "memset" };
+
+typedef struct
+{ unsigned count;    // #cycles the instruction at this PC retired
+  unsigned faults;   // #page faults taken at this PC
+  int opcode;        // opcode seen at this PC, -1 if never retired
+} typeProfPC;
+
+typeProfPC **profTable = NULL;   // per pid, maxPpages*pageSize entries
+unsigned profOPcount[numProfOPcode+1];   // last slot: illegal opcodes
+unsigned profFaults;
+
+void initialize_profiler ()
+{ int i;
+
+  if (profTable == NULL)
+    profTable = (typeProfPC **) malloc (maxProcess*sizeof(typeProfPC *));
+  for (i=0; i<maxProcess; i++) profTable[i] = NULL;
+  for (i=0; i<=numProfOPcode; i++) profOPcount[i] = 0;
+  profFaults = 0;
+}
+
+typeProfPC *get_profile_entry (int pid, int pc)
+{ typeProfPC *prof;
+  int i, size;
+
+  size = maxPpages*pageSize;
+  if (pid < 0 || pid >= maxProcess || pc < 0 || pc >= size) return (NULL);
+  prof = profTable[pid];
+  if (prof == NULL)
+  { prof = (typeProfPC *) malloc (size*sizeof(typeProfPC));
+    for (i=0; i<size; i++)
+    { prof[i].count = 0; prof[i].faults = 0; prof[i].opcode = -1; }
+    profTable[pid] = prof;
+  }
+  return (&prof[pc]);
+}
+
+// called by cpu.c after one instruction cycle of pid at pc
+// a page fault does not retire the instruction, it is re-executed later
+void profile_instruction (int pid, int pc, int opcode, int status)
+{ typeProfPC *prof;
+
+  prof = get_profile_entry (pid, pc);   // pid runs on one core at a time
+  if (status == ePFault)
+  { __sync_fetch_and_add (&profFaults, 1);
+    if (prof != NULL) prof->faults++;
+    return;
+  }
+  if (opcode < 0 || opcode >= numProfOPcode) opcode = numProfOPcode;
+  __sync_fetch_and_add (&profOPcount[opcode], 1);   // shared by the cores
+  if (prof != NULL) { prof->count++; prof->opcode = opcode; }
+}
+
+// turn the profiler on or off, turning it on clears the old profile
+void toggle_profiler ()
+{ int pid;
+
+  profileOn = !profileOn;
+  if (profileOn)
+  { for (pid=0; pid<maxProcess; pid++)
+      if (profTable[pid] != NULL)
+      { free (profTable[pid]); profTable[pid] = NULL; }
+    initialize_profiler ();
+  }
+  fprintf (infF, "Profiler is %s\n", profileOn ? "on" : "off");
+}
+
+char *profile_opname (int opcode)
+{
+  if (opcode < 0 || opcode >= numProfOPcode) return ("illegal");
+  return (profOPname[opcode]);
+}
+
+void dump_profile (FILE *outf)
+{ typeProfPC *prof;
+  int pid, pc, op;
+  unsigned total;
+
+  fprintf (outf, "******************** Profile Dump\n");
+  total = profFaults;
+  for (op=0; op<=numProfOPcode; op++) total = total + profOPcount[op];
+  for (op=0; op<=numProfOPcode; op++)
+    if (profOPcount[op] > 0)
+      fprintf (outf, "%-8s %10u (%.1f%%)\n",
+               (op == numProfOPcode) ? "illegal" : profOPname[op],
+               profOPcount[op], 100.0*profOPcount[op]/total);
+  fprintf (outf, "%-8s %10u (%.1f%%)\n", "pfault", profFaults,
+           (total == 0) ? 0.0 : 100.0*profFaults/total);
+  for (pid=0; pid<maxProcess; pid++)
+  { prof = profTable[pid];
+    if (prof == NULL) continue;
+    fprintf (outf, "Process %d:\n", pid);
+    for (pc=0; pc<maxPpages*pageSize; pc++)
+      if (prof[pc].count > 0 || prof[pc].faults > 0)
+        fprintf (outf, "  PC=%4d %-6s count=%u, pfault=%u\n", pc,
+                 (prof[pc].opcode < 0) ? "-" : profile_opname (prof[pc].opcode),
+                 prof[pc].count, prof[pc].faults);
+  }
+}
+
+// folded stacks, one line per (pid, PC), page faults as a child frame
+void write_profile_folded ()
+{ FILE *fprof;
+  typeProfPC *prof;
+  int pid, pc;
+
+  fprof = fopen (profileFname, "w");
+  if (fprof == NULL)
+  { fprintf (infF, "Error: cannot open %s\n", profileFname); return; }
+  for (pid=0; pid<maxProcess; pid++)
+  { prof = profTable[pid];
+    if (prof == NULL) continue;
+    for (pc=0; pc<maxPpages*pageSize; pc++)
+    { if (prof[pc].count > 0)
+        fprintf (fprof, "pid%d;page%d;pc%d_%s %u\n", pid, pc/pageSize, pc,
+                 (prof[pc].opcode < 0) ? "unknown"
+                   : profile_opname (prof[pc].opcode), prof[pc].count);
+      if (prof[pc].faults > 0)
+        fprintf (fprof, "pid%d;page%d;pc%d_%s;pagefault %u\n", pid,
+                 pc/pageSize, pc, (prof[pc].opcode < 0) ? "unknown"
+                   : profile_opname (prof[pc].opcode), prof[pc].faults);
+    }
+  }
+  fclose (fprof);
+  fprintf (infF, "Profile written to %s\n", profileFname);
+}
@@ -26,9 +26,31 @@ int systemActive;
 int maxProcess;    // max number of processes has to < maxProcess
 int cpuQuantum;    // time quantum, defined in # instruction-cycles
 int idleQuantum;   // time quantum for the idle process
+int numCores;      // #simulated cores, each runs on its own host thread
+int coreAffinity;  // 1: a ready process goes back to the core it ran on
 
 //memory
+// word format of memory and instructions, instruction = opcode | operand
+// default is 32-bit words with a 24-bit operand
+// build with -DwideWord (make WIDE=-DwideWord) for 64-bit words with a
+//   56-bit operand, offsets are still int, so up to 2^31 words per process
+// the 8-byte data types (see mdType below) always use 64-bit words
+#if (defined(mdInt64) || defined(mdDouble)) && !defined(wideWord)
+#define wideWord
+#endif
+#ifdef wideWord
+typedef long long mwordType;
+#define dataSize 8   // each memory unit is of size 8 bytes
+#define opcodeShift 56
+#define operandMask 0x00ffffffffffffffLL
+#define mwordFormat "0x%016llx"
+#else
+typedef int mwordType;
 #define dataSize 4   // each memory unit is of size 4 bytes
+#define opcodeShift 24
+#define operandMask 0x00ffffff
+#define mwordFormat "0x%08x"
+#endif
 #define addrSize 4   // each memory address is of size 4 bytes
 int pageSize, numFrames;
        // sizes related to memory and memory management
@@ -38,29 +60,72 @@ int loadPpages, maxPpages, OSpages;
        // OSpages = #pages for OS, OS occupies the begining of the memory
 int agescanPeriod; // the period for scanning and shifting the age vectors
                    // defined in # instruction-cycles
+int runAhead;   // max #pages prefetched past a page fault, 0: off
+int cpuEngine;   // instruction execution engine, see cpu.c
+#define switchEngine 0     // switch dispatch, the reference engine
+#define threadedEngine 1   // direct-threaded dispatch over decoded pages
+#define jitEngine 2        // threaded engine + native code for hot blocks
+int jitThreshold;   // #executions before a block is compiled
 int instrTime;   // instruction execution time (sleep)
 int termPrintTime;   // simulated time (sleep) for terminal to output a string
 int diskRWtime;   // simulated time (sleep) for disk IO (a page)
+int freeRun;   // 1: never sleep, device delays are counted in cycles (clock.c)
+int traceMode;   // instruction trace, see trace.c
+#define traceOff 0      // no trace
+#define traceRecord 1   // record the run into the trace file
+#define traceReplay 2   // replay the trace file, in place of admin commands
+int ckptRestore;   // 1: start from the checkpoint file, see checkpoint.c
+int cacheModel;   // 1: memory accesses go through the L1/L2 model, cache.c
+int stallsToClock;   // 1: cache stall cycles are added to the clock
+int L2stall, memStall;   // stall cycles of an L1 miss, hit / miss in L2
+int L1lines, L1assoc, L2lines, L2assoc;   // #lines and ways of each level
+int lineWords;   // #memory words in a cache line
+int cacheRepl;   // replacement: 0 LRU, 1 FIFO, 2 random
+#define osSwitch 0      // kinds of OS work, context_in, context_out
+#define osFault 1       // page_fault_handler
+#define osInterrupt 2   // each interrupt handle_interrupt dispatches
+#define osTimer 3       // add_timer, deactivate_timer
+#define numOsKinds 4
+int osCost[numOsKinds];   // cycles of each kind of OS work, see clock.c
 
 //=============== paging.c related definitions ====================
 
-// memory data type defintion, could be int or float
-//typedef int mdType;
-//#define mdInFormat "%d"
-//#define mdOutFormat "%d"
+// memory data type defintion, chosen at build time (make MDTYPE=-D...)
+//   mdInt32, mdFloat (default), mdInt64, mdDouble
+// the arithmetic in cpu.c, memory.c, vector.c is on mdType, so each
+// build is specialised for its type, nothing is decided at run time
+#if defined(mdInt32)
+typedef int mdType;
+#define mdInFormat "%d"
+#define mdOutFormat "%d"
+#elif defined(mdInt64)
+typedef long long mdType;
+#define mdInFormat "%lld"
+#define mdOutFormat "%lld"
+#elif defined(mdDouble)
+typedef double mdType;
+#define mdInFormat "%lf"
+#define mdOutFormat "%.2f"
+#else
+#define mdFloat
 typedef float mdType;
 #define mdInFormat "%f"
 #define mdOutFormat "%.2f"
+#endif
 
 typedef union     // type definition for memory (its content)
 { mdType mData;
-  int mInstr;
+  mwordType mInstr;
 } mType;
 
 #define mNormal 1  // memory access return values
 #define mError -1
 #define mPFault 0
 
+// rwflag of calculate_memory_address, whether the access is a read or a write
+#define flagRead 1
+#define flagWrite 2
+
 mType *Memory;
 
 // memory read/write function definitions
@@ -69,7 +134,7 @@ int get_data (int offset);
 int put_data (int offset);
 int get_instruction (int offset);
   // only cpu.c uses the above 3 functions
-void direct_put_instruction (int findex, int offset, int instr);
+void direct_put_instruction (int findex, int offset, mwordType instr);
 void direct_put_data (int findex, int offset, mdType data);
 int calculate_memory_address(unsigned offset, int flag);
   // only loader.c uses the above 2 functions
@@ -79,6 +144,8 @@ void  update_frame_info (int findex, int pid, int page);
   // process related memory functions
 void init_process_pagetable (int pid);
 void update_process_pagetable (int pid, int page, int frame);
+void count_page_change (int pid, int from, int to);
+  // resident and swapped page counts of pid, called by loader.c
 int free_process_memory (int pid);
 void dump_process_pagetable (int pid);
 void dump_process_memory (int pid);
@@ -97,25 +164,108 @@ void initialize_mframe_manager ();
 
 
 int find_allocated_memory(int pid, int page);
+  // frame table and page table lock, paging.c
+  // a core holds it shared while it executes instructions, changes to the
+  // frame table or to any page table take it exclusively
+  // calculate_memory_address has to be called with it held shared
+void memory_lock_shared ();
+void memory_lock_exclusive ();
+void memory_unlock ();
+volatile int memLockWanted;   // #threads waiting for the exclusive lock
+
+void reference_frame (int findex);
+  // mark the frame as accessed, used by icache.c on a decoded fetch
+void dirty_frame (int findex);   // mark the frame as written, used by jit.c
+int mapEpoch;   // bumped whenever a translation may have changed
+
+  // TLB shootdown, any change to a translation has to drop the TLB entry
+void tlb_shootdown (int pid, int page);
+void tlb_shootdown_frame (int findex);
+void tlb_flush_process (int pid);
+void dump_tlb (FILE *outf);
 
 
 //================= cpu.c related definitions ======================
 
-// Pid, Registers and interrupt vector in physical CPU
+// opcode definitions, also used by the modules that decode instructions
+#define OPexit 1
+#define OPload 2
+#define OPadd 3
+#define OPmul 4
+#define OPifgo 5
+#define OPstore 6
+#define OPprint 7
+#define OPsleep 8
+#define OPload2 9
+#define OPvadd 10     // vector instructions, see vector.c
+#define OPvmul 11
+#define OPvsum 12
+#define OPvscale 13
+#define OPmemcpy 14   // block memory instructions, also in vector.c
+#define OPmemset 15
+
+// software TLB, direct-mapped on page number, tagged by pid
+// caches page->frame translations for calculate_memory_address
+#define tlbSize 16   // #entries, has to be a power of 2
 
-struct
-{ int Pid;
+typedef struct
+{ int pid;
+  int page;
+  int frame;
+} typeTLBentry;
+
+// Pid, Registers and interrupt vector of one core of the physical CPU
+// every core has its own registers, TLB, timers (clock.c) and clock
+// CPU is the core of the calling thread: core k runs on its own host
+// thread, core 0 (bootCore) on the main thread, which also runs admin.c
+// the terminal and swap threads are bound to core 0, which takes the
+// device interrupts
+
+struct eventNode;   // timer event, see clock.c
+
+// delivery statistics of one interrupt source, see cpu.c
+#define numIntSources 4   // bits 0 .. 3 of interruptV
+
+typedef struct
+{ unsigned raised;     // #times the source was latched while not pending
+  unsigned served;     // #times handle_interrupt dispatched it
+  long long raisedAt;  // host time (ns) the pending source was latched
+  int raisedCycle;     // core clock when it was latched
+  long long waitNs, maxNs;   // latched -> dispatched, total and worst
+  long long waitCycles;
+} typeIntStat;
+
+typedef struct
+{ int coreId;
+  int Pid;
   int PC;
   int dataOffset;
   mdType AC;
   mdType MBR;
   int IRopcode;
   int IRoperand;
+  int IRoperand2, IRoperand3;   // vector instructions: operands of word 2, 3
+  int VIndex;   // vector instructions: #elements done, see vector.c
   int *PTptr;
   int exeStatus;
-  unsigned interruptV;
-  int numCycles;  // this is a global register, not for each process
-} CPU;
+  volatile unsigned interruptV;   // pending sources, set from any thread
+  unsigned interruptMask;   // masked sources stay pending, not dispatched
+  typeIntStat intStat[numIntSources];
+  int numCycles;  // clock of the core, not for each process
+  typeTLBentry TLB[tlbSize];
+  unsigned tlbHits, tlbMisses;
+  int fusedRetired;   // threaded engine: retired in superinstructions
+  int faultPage;   // page of the last page fault, calculate_memory_address
+  int stallCycles;   // cache stalls not yet on the clock, see cache.c
+  long long osCycles[numOsKinds];   // OS overhead of the core by kind
+  int osTime;   // all OS overhead of the core, see charge_os
+  struct eventNode *eventTree, *eventHead;   // timers of the core
+} typeCPU;
+
+#define bootCore 0
+typeCPU *cpuCores;   // numCores register sets
+extern __thread typeCPU *thisCore;   // core of the calling thread, cpu.c
+#define CPU (*thisCore)
 
 
 // define interrupt set bit for interruptV in CPU structure
@@ -127,6 +277,15 @@ struct
 #define pFaultException 8   // page fault exception
         // before setting endWait, caller should add the pid to endWait list
 
+// pending sources that are not masked, a handle_interrupt call is due
+#define interrupt_pending() (CPU.interruptV & ~CPU.interruptMask)
+
+// the engines run instructions in batches up to the next timer event,
+// without checking timers or interrupts on every instruction
+// an interrupt raised by another thread (terminal, swap) or a thread
+// waiting for the memory lock cuts the running batch short
+#define batch_break() (interrupt_pending () || memLockWanted)
+
 
 
 
@@ -143,7 +302,9 @@ struct
 
 // cpu function definitions
 
-void initialize_cpu ();  // called by system.c
+void initialize_cpu ();  // called by system.c, sets up all the cores
+void bind_core (int core);
+     // the calling thread runs core (or takes its interrupts)
 void cpu_execution ();   // called by process.c
 
 void set_interrupt (unsigned bit);
@@ -151,11 +312,167 @@ void set_interrupt (unsigned bit);
      // called by clock.c for endWaitInterrupt (sleep)
      // called by term.c for endWaitInterrupt (termio)
      // called by clock.c for endWaitInterrupt (page fault)
+     // safe to call from any thread, the bit is latched atomically
+void clear_interrupt (unsigned bit);   // also used by trace.c for endIO
+void mask_interrupt (unsigned bits);     // hold back, stay latched
+void unmask_interrupt (unsigned bits);   // by the thread running the core
+void dump_interrupts (FILE *outf);   // latency counters, called by admin.c
 void dump_registers (FILE *outf);
+void dump_core_registers (FILE *outf);   // all cores, called by admin.c
 void handle_interrupt (); // called locally in cpu.c and by idle.c
 
+//=============== icache.c related definitions ====================
+
+// predecoded form of one instruction word
+typedef struct
+{ int opcode;
+  int operand;
+  int target;   // OPifgo only: goto address from the second word
+  int length;   // #words consumed, 2 for a joined OPifgo, 0 = not decoded
+  int fused;    // superinstruction starting at this word, see below
+  int fuseLen;  // #instructions (= #cycles) covered by the superinstruction
+  void *handler;   // threaded engine: address of the handler in cpu.c
+  int hotness;     // jit engine: #times a block started here
+  void *jit;       // jit engine: compiled block starting here (jit.c)
+} typeDecoded;
+
+typedef struct
+{ int valid;    // page is decoded and still mapped to frame
+  int threaded;   // handlers of the entries have been set by cpu.c
+  int frame;
+  int numCode;   // #instructions in the page
+  int numFused;  // #instructions covered by superinstructions (greedy)
+  typeDecoded *instr;   // pageSize entries
+} typeICachePage;
+
+// superinstructions, fused when a page is decoded
+// each part still takes one cycle and may fault on its own
+#define fuseNone 0
+#define fuseLAS 1    // load a; add b; store c
+#define fuseLMS 2    // load a; mul b; store c
+#define fuseLMAS 3   // load a; mul b; add c; store d
+#define fuseSI 4     // store a; ifgo b (two words)
+
+void initialize_icache ();   // called by system.c
+void icache_load_page (int pid, int page, int frame);
+     // called by swap.c and loader.c after a code page is in memory
+void icache_invalidate_page (int pid, int page);
+     // called by memory.c when a store hits the page, paging.c on free
+void icache_remap_page (int pid, int page, int frame);
+     // called by paging.c when the page table entry changes
+void icache_free_process (int pid);   // called by paging.c
+typeDecoded *icache_fetch (int pid, int offset);   // called by cpu.c
+typeICachePage *icache_page (int pid, int offset);   // called by cpu.c
+void dump_fusion (FILE *outf, int pid);
+     // superinstruction coverage of a process, called by process.c, admin.c
+
+//=============== jit.c related definitions ====================
+
+void initialize_jit ();   // called by system.c
+int jit_execute (typeICachePage *cpage, typeDecoded *di, int pc, int budget);
+     // called by cpu.c, returns #cycles run natively, 0 to interpret
+void dump_jit (FILE *outf);
+
+//=============== vector.c related definitions ====================
+
+void initialize_vector ();   // called by system.c
+int vector_length (int opcode);   // #words of a vector instruction, or 0
+int vector_fetch ();   // called by cpu.c, fetch the extra operand words
+void vector_execute ();   // called by cpu.c, restartable on page faults
+     // also executes the block memory instructions OPmemcpy, OPmemset
+
+//=============== prefetch.c related definitions ====================
+
+void run_ahead (int pid);
+     // called by paging.c on a page fault of the running process pid,
+     // with memLock held exclusively
+int prefetch_page (int pid, int page);
+     // paging.c, queue a read of a disk page into a free frame, 0 if none
+int prefetch_waiting (int pid);
+     // paging.c, 1 if pid waits for a prefetched page that is now in,
+     // called by swap.c and clock.c when a prefetch read is done
+
+//=============== trace.c related definitions ====================
+
+void initialize_trace ();   // called by system.c, after configuration
+void end_trace ();   // called by system.c
+void replay_trace ();   // called by system.c in replay mode
+void trace_retire (int pc);   // cpu.c, the instruction at pc has run
+void trace_access (int offset, int rwflag);   // memory.c, vector.c
+void trace_interrupt (unsigned bit);   // cpu.c, interrupt dispatched
+void trace_schedule_in (int pid);   // process.c, idle.c
+void trace_schedule_out (int status);   // process.c
+void trace_submit (char *fname);   // process.c, record mode
+void trace_device_done (int pid, int page);
+     // term.c (page -1), swap.c: a completion for the core, raises endIO
+void trace_take_devices ();
+     // cpu.c, the endIO handler takes the completions in
+void trace_inject ();   // cpu.c, idle.c, replay: raise the recorded endIO
+int trace_budget (int budget);   // cpu.c, replay: batch up to the next input
+void trace_round ();   // process.c, replay: the submissions of the round
+
+//=============== checkpoint.c related definitions ====================
+
+void save_checkpoint ();   // called by admin.c
+void restore_checkpoint ();   // called by admin.c, system.c
+void checkpoint_config ();   // called by system.c, sizes of the checkpoint
+void ckpt_write (void *data, long long size);
+void ckpt_write_int (int v);
+void *ckpt_read (long long size);   // the next size bytes of the mapped file
+int ckpt_read_int ();
+
+     // the part of each module, restored in the order it is saved
+void checkpoint_processes ();   // process.c, PCBs, page tables, queues
+void restore_processes ();
+void checkpoint_memory ();   // paging.c, Memory[] and the frame table
+void restore_memory ();
+void checkpoint_cpu ();   // cpu.c, registers of the cores
+void restore_cpu ();
+void checkpoint_timers ();   // clock.c, event trees of the cores
+void restore_timers ();
+void checkpoint_swap ();   // swap.c, swap queue and the swap space
+void restore_swap ();
+void checkpoint_term ();   // term.c, terminal queue
+void restore_term ();
+
+     // the device threads are held while the machine is saved or restored
+void lock_swapQ ();
+void unlock_swapQ ();
+int swapQ_empty ();
+void lock_termQ ();
+void unlock_termQ ();
+int termQ_empty ();
+
+//=============== cache.c related definitions ====================
+
+void initialize_cache ();   // called by system.c
+void cache_access (int maddr, int rwflag);
+     // called by memory.c for every access, adds to CPU.stallCycles
+void cache_access_range (int maddr, int n, int rwflag);   // by vector.c
+void cache_flush_frame (int findex);   // by paging.c, frame is reused
+void dump_cache_process (FILE *outf, int pid);   // by process.c on exit
+void dump_cache (FILE *outf);   // by admin.c
+
+//=============== profile.c related definitions ====================
+
+int profileOn;   // 1: cpu.c reports every instruction cycle to profile.c
+void initialize_profiler ();   // called by system.c
+void profile_instruction (int pid, int pc, int opcode, int status);
+     // called by cpu.c after each instruction cycle when profileOn
+void toggle_profiler ();   // called by admin.c
+void dump_profile (FILE *outf);
+void write_profile_folded ();   // folded stacks for flamegraph tools
+
 //=============== process.c related definitions ====================
 
+// what a process is doing, for its resource usage (account_state)
+#define rsRun 0
+#define rsReady 1
+#define rsPFWait 2     // page fault, waiting for its page
+#define rsTermWait 3   // waiting for its output
+#define rsSleep 4
+#define numRStates 5
+
 typedef struct
 { int Pid;
   int PC;
@@ -169,6 +486,19 @@ typedef struct
   int burstTime;
   int arrivalTime;
   int waitingTime;
+  int numInstr;   // #instructions retired by the threaded engine
+  int numFused;   // #instructions of those retired in superinstructions
+  int VIndex;   // progress of an interrupted vector instruction
+  int core;     // core the process last ran on, nullCore if none
+  int pfWaitPage;   // page fault on a page being prefetched, nullWait if none
+  int numPrefetch;   // #pages prefetched by run-ahead (prefetch.c)
+  int osTime;   // OS overhead during its rounds, not part of timeUsed
+  int rState, rSince;   // resource usage: state and the cycle it began
+  int rCycles[numRStates];   // cycles spent in each state
+  int numDispatch, numPreempt;   // #rounds, #rounds ended by time quantum
+  int pagesRead, pagesWritten;   // #swap requests for its pages
+  int residentPages, peakResident;   // pages in memory
+  int swapPages, peakSwap;   // pages only on disk, in their swap slot
 } typePCB;
 
 typePCB **PCB;
@@ -181,6 +511,8 @@ typePCB **PCB;
 #define nullPid -1
 #define osPid 0
 #define idlePid 1
+#define nullCore -1
+#define nullWait -1
 
 
 // define process manipulation functions
@@ -207,7 +539,14 @@ void endIO_moveto_ready ();
 void dump_PCB (FILE *outf, int pid);
 void dump_PCB_list (FILE *outf);
 void dump_PCB_memory (FILE *outf);
+void dump_PCB_fusion (FILE *outf);
 void dump_MLFQ (FILE *outf);
+void dump_rusage (FILE *outf, int pid);
+void dump_rusage_list (FILE *outf);   // called by admin.c
+
+void account_state (int pid, int state);
+  // the cycles since the last change go to the old state, called by
+  // paging.c (page fault), term.c (output), cpu.c (sleep)
 
 void insert_endIO_list (int pid);
   // move all the processes in endIO list to ready queue
@@ -222,7 +561,11 @@ void initialize_process_manager ();  // called by system.c
 int submit_process (char* fname);  // called by submit.c
   // call loader functions to load the submitted process to swap and memory
   // put the process to ready queue
-void execute_process ();  // called by admin.c
+void execute_process ();  // one round on the core of the calling thread
+void execute_rounds (int rounds);
+  // called by admin.c, every core runs #rounds of execute_process
+void start_cores ();  // called by system.c, one thread for each core > 0
+void end_cores ();  // called by system.c
 
 
 int get_free_frame (); // by loader.c
@@ -235,16 +578,24 @@ int get_free_frame (); // by loader.c
 #define freeBuf 2   // 1: do nothing, 2: swap.c should free the input buffer
 #define toReady 4   // 4: swap.c should sesnd the process to ready queue
 #define Both    6   // 6: both 2 and 4 (not used)
+#define prefetchRead 8   // 8: run-ahead read, readies the process if it
+                         //    waits for the page (prefetch_waiting)
+#define cancelRead 16    // 16: the process has exited, drop the read
 #define actRead 0   // flags for act (action), read or write, with(out) signal
 #define actWrite 1
 
-void insert_swapQ (int pid, int page, unsigned *buf, int act, int finishact);
+void insert_swapQ (int pid, int page, mwordType *buf, int act, int finishact);
 void dump_swapQ ();
 int dump_process_swap_page (int pid, int page);
 void dump_process_swap (int pid);
 void dump_swap ();
 void start_swap_manager ();
 void end_swap_manager ();
+void wait_disk_done ();  // called by clock.c in free-running mode
+void cancel_prefetch (int pid);   // called by paging.c on process exit
+int swap_read_done (int pid, int page);
+     // called by trace.c, the core takes the read at the head of the queue
+     // in, 0 if that is not the read of pid/page
 
 //=============== clock.c related definitions ====================
 
@@ -254,15 +605,27 @@ void end_swap_manager ();
 #define actTQinterrupt 1
 #define actAgeInterrupt 2
 #define actReadyInterrupt 3
+#define actDiskDone 4   // free-running mode, a disk request is done
+#define actTermDone 5   // free-running mode, a terminal output is done
+#define actPrefetchDone 6   // free-running mode, a prefetch read is done
 #define actNull 0
 
 // define the clock function
 void advance_clock ();
      // called by cpu.c to advance instruction cycle based clock
+void advance_clock_by (int n);
+     // called by cpu.c after running n instructions in one batch
+int cycles_to_next_timer ();
+     // called by cpu.c, #cycles that can run before a timer is due
+int device_delay (int *busyUntil, int usec);
+     // called by swap.c and term.c, #cycles till a device request is done
+void charge_os (int kind);
+     // called by process.c, cpu.c, paging.c, the OS work costs cycles
 
 // define the timer functions
-void dump_events ();
-void initialize_timer ();  // called by system.c
+void dump_events ();   // timers of the calling core
+void dump_core_events ();   // timers of all cores, called by admin.c
+void initialize_timer ();  // called by system.c, after initialize_cpu
 genericPtr add_timer (int time, int pid, int action, int recurperiod);
            // called by process.c for time quantum,
            // by memory.c for age scan, by cpu.c for sleep timer
@@ -282,6 +645,7 @@ void insert_termIO (int pid, char *outstr, int status);
 void dump_termIO_queue (FILE *outf);
 void start_terminal ();  // called by system.c
 void end_terminal ();  // called by system.c
+void wait_term_done ();  // called by clock.c in free-running mode
 
 
 //=============== other modules ====================
@@ -2,6 +2,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <semaphore.h>
@@ -17,14 +18,21 @@
 #define swapFname "swap.disk"
 #define itemPerLine 8
 int diskfd;
-int swapspaceSize;
-int PswapSize;
+off_t swapspaceSize;   // off_t, wide words and large processes can
+off_t PswapSize;       // take the swap space beyond 2G
 int pagedataSize;
 
 sem_t swap_mutex;
 sem_t disk_mutex;
 sem_t swap_semaphore;
 
+// free-running mode: the disk delay is not slept but counted in cycles
+// insert_swapQ sets a timer (actDiskDone) for the cycle the request is
+// done, the swap thread posts disk_done for each request it finished
+// and the timer waits for it, so the result does not depend on host speed
+sem_t disk_done;
+int diskBusyUntil = 0;
+
 //===================================================
 // This is the simulated disk, including disk read, write, dump.
 // The unit is a page
@@ -36,8 +44,8 @@ sem_t swap_semaphore;
 
 
 // move to proper file location before read/write/dump
-int move_filepointer (int pid, int page)
-{ int currentoffset, newlocation, ret;
+off_t move_filepointer (int pid, int page)
+{ off_t currentoffset, newlocation, ret;
 
   if (pid <= idlePid || pid > maxProcess)
   { printf ( "Error: Incorrect pid for disk dump: %d\n", pid);
@@ -48,26 +56,26 @@ int move_filepointer (int pid, int page)
     exit (-1);
   }
   currentoffset = lseek (diskfd, 0, SEEK_CUR);
-  newlocation = (pid-2) * PswapSize + page*pagedataSize;
+  newlocation = (pid-2) * PswapSize + (off_t) page*pagedataSize;
   ret = lseek (diskfd, newlocation, SEEK_SET);
   if (ret < 0)
   { printf ( "Error lseek in move: ");
-    printf ( "pid/page=%d,%d, loc=%d,%d, size=%d\n",
-             pid, page, currentoffset, newlocation, pagedataSize);
+    printf ( "pid/page=%d,%d, loc=%lld,%lld, size=%d\n",
+             pid, page, (long long) currentoffset, (long long) newlocation,
+             pagedataSize);
     exit (-1);
   }
   return (currentoffset);
-    // currentoffset cannot be larger than 2G
 }
 
 // originally prepared for dump, now not in use
-void moveback_filepointer (int location)
-{ int ret;
+void moveback_filepointer (off_t location)
+{ off_t ret;
 
   ret = lseek (diskfd, location, SEEK_SET);
   if (ret < 0)
   { printf ( "Error lseek in moveback: ");
-    printf ( "location=%d\n", location);
+    printf ( "location=%lld\n", (long long) location);
     exit (-1);
   }
 }
@@ -78,7 +86,7 @@ void moveback_filepointer (int location)
 // Solution: use mutex semaphore to protect them
 // each function recomputes address, so there will be no problem
 
-int read_swap_page (int pid, int page, unsigned *buf)
+int read_swap_page (int pid, int page, mwordType *buf)
 { int ret;
 
   move_filepointer (pid, page);
@@ -87,10 +95,10 @@ int read_swap_page (int pid, int page, unsigned *buf)
   { printf ( "Error: Disk read returned incorrect size: %d\n", ret);
     exit(-1);
   }
-  usleep (diskRWtime);  // simulate the delay for disk RW
+  if (!freeRun) usleep (diskRWtime);  // simulate the delay for disk RW
 }
 
-int write_swap_page (int pid, int page, unsigned *buf)
+int write_swap_page (int pid, int page, mwordType *buf)
 { int ret;
 
   move_filepointer (pid, page);
@@ -99,14 +107,15 @@ int write_swap_page (int pid, int page, unsigned *buf)
   { printf ( "Error: Disk write returned incorrect size: %d\n", ret);
     exit(-1);
   }
-  usleep (diskRWtime);  // simulate the delay for disk RW
+  if (!freeRun) usleep (diskRWtime);  // simulate the delay for disk RW
 }
 
 
 
 int dump_process_swap_page (int pid, int page)
-{ int oldloc, ret, retsize, k;
-  int buf[pageSize];
+{ int ret, retsize, k;
+  off_t oldloc;
+  mwordType buf[pageSize];
 
 
   int tInstr, tOpcode, tOperand;
@@ -124,7 +133,7 @@ int dump_process_swap_page (int pid, int page)
   for (k=0; k<pageSize; k++) {
 
 	  temp->mInstr = buf[k];
-	  printf ("0x%016x|%.2f \n", buf[k],temp->mData);
+	  printf (mwordFormat"|"mdOutFormat" \n", buf[k],temp->mData);
   }
   printf ("\n");
 
@@ -139,11 +148,12 @@ void dump_process_swap (int pid)
 
 // open the file with the swap space size, initialize content to 0
 void initialize_swap_space ()
-{ int ret, i, j, k;
-  int buf[pageSize];
+{ int i, j, k;
+  off_t ret;
+  mwordType buf[pageSize];
 
-  swapspaceSize = maxProcess*maxPpages*pageSize*dataSize;
-  PswapSize = maxPpages*pageSize*dataSize;
+  swapspaceSize = (off_t) maxProcess*maxPpages*pageSize*dataSize;
+  PswapSize = (off_t) maxPpages*pageSize*dataSize;
   pagedataSize = pageSize*dataSize;
 
   diskfd = open (swapFname, O_RDWR | O_CREAT, 0600);
@@ -173,7 +183,7 @@ void initialize_swap_space ()
 
 typedef struct SwapQnodeStruct
 { int pid, page, act, finishact;
-  unsigned *buf;
+  mwordType *buf;
   struct SwapQnodeStruct *next;
 } SwapQnode;
 // pidin, pagein, inbuf: for the page with PF, needs to be brought in
@@ -203,74 +213,35 @@ void dump_swapQ ()
   printf ("\n");
 }
 
-void process_one_swap()
-{
-  SwapQnode *node;
-  int i, frame, ret;
+// put a page read from disk in memory, readying the process if it waits
+// the frame table and page tables change, memLock is taken (before
+// swap_mutex, paging.c inserts requests holding it), the caller must not
+// hold swap_mutex; only the swap thread (or trace.c) removes the head
+// node, so it stays valid
+void swap_read_in (SwapQnode *node)
+{ int i, frame, ret;
   mType *buf = (mType *) malloc (pageSize*sizeof(mType));
 
-  sem_wait(&swap_semaphore);
-  sem_wait(&swap_mutex);
-
-  if (swapQhead == NULL)
-  { printf ("\aError: No process in swap queue!!!\n");
-    sem_post(&swap_mutex);
-  }
-  else
-  {
-	  node = swapQhead;
-	  printf ("\nPage Fault Handler: pid,page=(%d,%d), act,ready=(%d, %d), buf=%x,\n",
-           node->pid, node->page, node->act, node->finishact, node->buf);
-	  if (node->act == actWrite)
-    {
-      //write to swapDisk from memory
-		  write_swap_page(node->pid, node->page, node->buf);
-		  for (i=0;i<pageSize;i++)
-      {
-			  buf[i].mInstr = (int)node->buf[i];
-			  if (PCB[node->pid]->dataOffset <= (node->page*pageSize+i))
-        {
-				  printf("Data: 0x%016x %f \n", buf[i], buf[i].mData);
-
-			  }
-			  else {
-				  printf("Instruction: 0x%016x\n", buf[i]);
-
-			  } // end else
-		  } // end for
-	  } // end if
-	  else if (node->act == actRead)
-    {
-      //read from disk, then send to load_data or load_instruction
-		  node->buf = (unsigned *) malloc (pageSize*sizeof(unsigned));
-		  read_swap_page(node->pid, node->page, node->buf);
-		  frame = find_allocated_memory(node->pid, node->page);
+		  memory_lock_exclusive ();
+		  if (node->finishact == cancelRead) frame = -1;
+		  else frame = find_allocated_memory(node->pid, node->page);
 		  if (frame < 0)
       {
         //if no frame returned, just remove node and exit
-			  update_process_pagetable (node->pid, node->page, -1);
-			  if (swapDebug)
-        {
-          printf ("Remove swap queue %d %d\n", node->pid, node->page);
-        }
-			  swapQhead = node->next;
-			  if (swapQhead == NULL)
-        {
-          swapQtail = NULL;
-        }
-			  free (node->buf); free (node);
-			  sem_post(&swap_semaphore); sem_post(&swap_mutex);
-			  if (swapQhead == NULL) sem_wait(&swap_semaphore);
+			  if (node->finishact != cancelRead)
+			    update_process_pagetable (node->pid, node->page, -1);
+			  memory_unlock ();
+			  free (buf);
 			  return;
       }
 		   update_frame_info (frame, node->pid, node->page);
 		   update_process_pagetable (node->pid, node->page, frame);
 		  for (i=0;i<pageSize;i++)
       {
-			  buf[i].mInstr = (int)node->buf[i];
+			  buf[i].mInstr = node->buf[i];
 			  if (PCB[node->pid]->dataOffset <= (node->page*pageSize+i))
         {
-				  printf("Data: 0x%016x %f \n", buf[i], buf[i].mData);
+				  printf("Data: "mwordFormat" "mdOutFormat" \n", buf[i].mInstr, buf[i].mData);
 				  ret=load_data (&buf[i], frame, i);
 				  if (ret == mError)
           {
@@ -279,7 +250,7 @@ void process_one_swap()
 
 			  } // end if
 			  else {
-				  printf("Instruction: 0x%016x\n", buf[i]);
+				  printf("Instruction: "mwordFormat"\n", buf[i].mInstr);
 				  ret=load_instruction (&buf[i], frame, i);
 				  if (ret == mError)
           {
@@ -288,15 +259,81 @@ void process_one_swap()
 
 			  }
 		  }
+		  // decode the instructions of a code page once it is in memory
+		  icache_load_page (node->pid, node->page, frame);
 
 
-		 if (node->finishact == toReady || node->finishact == Both)
+		 if (!freeRun &&
+         (node->finishact == toReady || node->finishact == Both))
       {
 
         // ADDCODE HERE //
 			  insert_endIO_list(node->pid);
 			  endIO_moveto_ready ();
       }
+		 else if (!freeRun && node->finishact == prefetchRead
+		          && prefetch_waiting (node->pid))
+      {
+        // the process faulted on this page while it was being prefetched
+			  insert_endIO_list(node->pid);
+			  endIO_moveto_ready ();
+      }
+		 memory_unlock ();
+		 free (buf);
+}
+
+// trace mode (trace.c): the swap thread leaves a read page to the core,
+// which takes it in at the endIO interrupt (swap_read_done)
+sem_t read_taken;
+
+void process_one_swap()
+{
+  SwapQnode *node;
+  int i;
+  mType *buf = (mType *) malloc (pageSize*sizeof(mType));
+
+  sem_wait(&swap_semaphore);
+  sem_wait(&swap_mutex);
+
+  if (swapQhead == NULL)
+  { printf ("\aError: No process in swap queue!!!\n");
+    sem_post(&swap_mutex);
+  }
+  else
+  {
+	  node = swapQhead;
+	  printf ("\nPage Fault Handler: pid,page=(%d,%d), act,ready=(%d, %d), buf=%x,\n",
+           node->pid, node->page, node->act, node->finishact, node->buf);
+	  if (node->act == actWrite)
+    {
+      //write to swapDisk from memory
+		  write_swap_page(node->pid, node->page, node->buf);
+		  for (i=0;i<pageSize;i++)
+      {
+			  buf[i].mInstr = node->buf[i];
+			  if (PCB[node->pid]->dataOffset <= (node->page*pageSize+i))
+        {
+				  printf("Data: "mwordFormat" "mdOutFormat" \n", buf[i].mInstr, buf[i].mData);
+
+			  }
+			  else {
+				  printf("Instruction: "mwordFormat"\n", buf[i].mInstr);
+
+			  } // end else
+		  } // end for
+	  } // end if
+	  else if (node->act == actRead)
+    {
+      //read from disk, then send to load_data or load_instruction
+		  node->buf = (mwordType *) malloc (pageSize*sizeof(mwordType));
+		  read_swap_page(node->pid, node->page, node->buf);
+		  sem_post(&swap_mutex);
+		  if (traceMode == traceRecord)
+		  { trace_device_done (node->pid, node->page);
+		    sem_wait(&read_taken);
+		  }
+		  else swap_read_in (node);
+		  sem_wait(&swap_mutex);
 	  }
 
 
@@ -307,17 +344,58 @@ void process_one_swap()
 	  swapQhead = node->next;
 	  if (swapQhead == NULL) swapQtail = NULL;
       free (node->buf); free (node);
+	  if (freeRun) sem_post(&disk_done);  // the actDiskDone timer notifies
 	  sem_post(&swap_semaphore); sem_post(&swap_mutex);
 	  if (swapQhead == NULL) sem_wait(&swap_semaphore);
   }
+  free (buf);
+}
+
+// trace modes, called by the core at the endIO interrupt (trace.c)
+// record: the swap thread has read the page and waits in process_one_swap
+// replay: there is no swap thread, the page is read and dequeued here
+int swap_read_done (int pid, int page)
+{ SwapQnode *node;
+
+  node = swapQhead;
+  if (node == NULL || node->act != actRead
+      || node->pid != pid || node->page != page) return (0);
+  if (traceMode == traceRecord)
+  { swap_read_in (node);
+    sem_post(&read_taken);
+    return (1);
+  }
+  node->buf = (mwordType *) malloc (pageSize*sizeof(mwordType));
+  read_swap_page(node->pid, node->page, node->buf);
+  swap_read_in (node);
+  if (swapDebug) printf ("Remove swap queue %d %d\n", node->pid, node->page);
+  swapQhead = node->next;
+  if (swapQhead == NULL) swapQtail = NULL;
+  free (node->buf); free (node);
+  return (1);
 }
 
 
 void insert_swapQ (pid, page, buf, act, finishact)
 int pid, page, act, finishact;
-unsigned *buf;
-{ SwapQnode *node; unsigned *temp = (unsigned *) malloc (pageSize*sizeof(unsigned));
-  int i; unsigned temp2;
+mwordType *buf;
+{ SwapQnode *node; mwordType *temp = (mwordType *) malloc (pageSize*sizeof(mwordType));
+  int i; mwordType temp2;
+
+  if (PCB[pid] != NULL)   // resource usage of the process, see process.c
+  { if (act == actRead) PCB[pid]->pagesRead++;
+    else PCB[pid]->pagesWritten++;
+  }
+  if (traceMode == traceReplay)   // no swap thread, see swap_read_done
+  { if (act == actWrite) { write_swap_page (pid, page, buf); return; }
+    node = (SwapQnode *) malloc (sizeof (SwapQnode));
+    node->pid = pid; node->page = page;
+    node->act = act; node->finishact = finishact;
+    node->buf = buf; node->next = NULL;
+    if (swapQhead == NULL) { swapQhead = node; swapQtail = node; }
+    else { swapQtail->next = node; swapQtail = node; }
+    return;
+  }
 
   sem_wait(&swap_mutex);
 
@@ -332,9 +410,9 @@ unsigned *buf;
   node->next = NULL;
   if (act == actWrite)
   {
-	  node->buf = (unsigned *) malloc (pageSize*sizeof(unsigned));
+	  node->buf = (mwordType *) malloc (pageSize*sizeof(mwordType));
 	  for (i=0;i<pageSize;i++){
-		  printf("0x%016x ",buf[i]);
+		  printf(mwordFormat" ",buf[i]);
 		  temp2 = buf[i];
 
 		  node->buf[i] = temp2;
@@ -353,14 +431,116 @@ unsigned *buf;
   else {
 	  swapQtail->next = node; swapQtail = node;
   }
+  if (freeRun && finishact == prefetchRead)
+    add_timer (device_delay (&diskBusyUntil, diskRWtime), pid,
+               actPrefetchDone, oneTimeTimer);
+  else if (freeRun)
+    add_timer (device_delay (&diskBusyUntil, diskRWtime),
+               (finishact == toReady || finishact == Both) ? pid : nullPid,
+               actDiskDone, oneTimeTimer);
   if (swapDebug) dump_swapQ ();
   sem_post(&swap_semaphore);
   sem_post(&swap_mutex);
   if (swapQhead!=node) sem_wait(&swap_semaphore);
 }
 
+// the process has exited, its prefetch reads in the queue are dropped
+// when the swap thread gets to them, the frames they hold are freed by
+// free_process_memory (paging.c), which holds memLock
+void cancel_prefetch (int pid)
+{ SwapQnode *node;
+
+  sem_wait(&swap_mutex);
+  for (node = swapQhead; node != NULL; node = node->next)
+    if (node->pid == pid && node->act == actRead
+        && node->finishact == prefetchRead)
+      node->finishact = cancelRead;
+  sem_post(&swap_mutex);
+}
+
+// called by clock.c (main thread) when the actDiskDone timer expires
+void wait_disk_done ()
+{
+  sem_wait(&disk_done);
+}
+
+//===================================================
+// checkpoint (checkpoint.c): the swap queue and the whole swap space
+// the swap thread is held on swap_mutex, a read it has taken from the
+// queue but not yet put in memory (it waits for memLock) is saved as
+// queued and is done again after a restore
+//===================================================
+
+void lock_swapQ () { sem_wait(&swap_mutex); }
+void unlock_swapQ () { sem_post(&swap_mutex); }
+int swapQ_empty () { return (swapQhead == NULL); }
+
+// free-running mode: the completions posted but not yet taken by a timer
+void set_sem_value (sem_t *sem, int value)
+{
+  while (sem_trywait (sem) == 0);
+  while (value-- > 0) sem_post (sem);
+}
+
+void checkpoint_swap ()
+{ SwapQnode *node;
+  mwordType buf[1024];
+  off_t off;
+  int n, size;
+
+  for (n=0, node=swapQhead; node!=NULL; node=node->next) n++;
+  ckpt_write_int (n);
+  for (node=swapQhead; node!=NULL; node=node->next)
+  { ckpt_write_int (node->pid); ckpt_write_int (node->page);
+    ckpt_write_int (node->act); ckpt_write_int (node->finishact);
+    if (node->act == actWrite) ckpt_write (node->buf, pagedataSize);
+  }
+  sem_getvalue (&disk_done, &n);
+  ckpt_write_int (n);
+  ckpt_write_int (diskBusyUntil);
+  for (off=0; off<swapspaceSize; off=off+size)
+  { size = (swapspaceSize - off < sizeof(buf)) ? swapspaceSize - off
+                                               : sizeof(buf);
+    n = pread (diskfd, buf, size, off);
+    if (n < 0) { perror ("Error swap space read for checkpoint: "); exit (-1); }
+    if (n < size) memset ((char *) buf + n, 0, size - n);
+      // the space past the last page written is not in the file yet
+    ckpt_write (buf, size);
+  }
+}
+
+// the live queue is empty (checkpoint.c checks it) and the thread waits on it;
+// the saved queue is put back in order and the thread is woken for it
+// (a replay has no swap thread, see swap_read_done)
+void restore_swap ()
+{ SwapQnode *node;
+  int n;
+
+  for (n = ckpt_read_int (); n > 0; n--)
+  { node = (SwapQnode *) malloc (sizeof (SwapQnode));
+    node->pid = ckpt_read_int (); node->page = ckpt_read_int ();
+    node->act = ckpt_read_int (); node->finishact = ckpt_read_int ();
+    node->buf = NULL;
+    if (node->act == actWrite)
+    { node->buf = (mwordType *) malloc (pagedataSize);
+      memcpy (node->buf, ckpt_read (pagedataSize), pagedataSize);
+    }
+    node->next = NULL;
+    if (swapQtail == NULL) swapQhead = node; else swapQtail->next = node;
+    swapQtail = node;
+  }
+  set_sem_value (&disk_done, ckpt_read_int ());
+  diskBusyUntil = ckpt_read_int ();
+  if (pwrite (diskfd, ckpt_read (swapspaceSize), swapspaceSize, 0)
+      != swapspaceSize)
+  { printf ("Error: swap space write for restore\n"); exit (-1); }
+  if (swapQhead != NULL && traceMode != traceReplay)
+    sem_post(&swap_semaphore);   // wake the swap thread up
+}
+
 void *process_swapQ ()
 {
+  bind_core (bootCore);   // the disk interrupts core 0
   while (systemActive) process_one_swap ();
   if (swapDebug) printf ("swapQ loop has ended\n");
 
@@ -375,10 +555,13 @@ void start_swap_manager ()
   sem_init(&swap_semaphore,0,1);
   sem_init(&swap_mutex,0,1);
   sem_init(&disk_mutex,0,1);
+  sem_init(&disk_done,0,0);
+  sem_init(&read_taken,0,0);
   // initialize_swap_space ();
   initialize_swap_space ();
   sem_wait(&swap_semaphore);
   printf ("Swap space manager is activated.\n");
+  if (traceMode == traceReplay) return;   // the core does the reads
   // create swap thread
   ret = pthread_create (&swapThread, NULL, process_swapQ, NULL);
   if (ret < 0) printf ("Error in Swap Thread Creatiom\n");
@@ -390,6 +573,7 @@ void end_swap_manager ()
   // terminate the swap thread
   sem_post(&swap_semaphore); sem_post(&swap_mutex); //**DG
   close (diskfd);
+  if (traceMode == traceReplay) return;
   pthread_join (swapThread, NULL);
   printf ("Swap Manager thread has terminated %d.\n");
 
@@ -12,20 +12,39 @@ void configure_system ()
   char str[60];
 
   fconfig = fopen ("config.sys", "r");
-  fscanf (fconfig, "%d %d %d %s\n",
+  fscanf (fconfig, "%d %d %d %59s\n",
           &maxProcess, &cpuQuantum, &idleQuantum, str);
-  fscanf (fconfig, "%d %d %s\n", &pageSize, &numFrames, str);
-  fscanf (fconfig, "%d %d %d %s\n", &loadPpages, &maxPpages, &OSpages, str);
-  fscanf (fconfig, "%d %d %d %d %s\n",
+  fscanf (fconfig, "%d %d %59s\n", &pageSize, &numFrames, str);
+  fscanf (fconfig, "%d %d %d %59s\n", &loadPpages, &maxPpages, &OSpages, str);
+  fscanf (fconfig, "%d %d %d %d %59s\n",
           &agescanPeriod, &instrTime, &termPrintTime, &diskRWtime, str);
-  fscanf (fconfig, "%d %d %d %d %d %d %s\n",
+  fscanf (fconfig, "%d %d %d %d %d %d %59s\n",
           &cpuDebug, &memDebug, &termDebug, &swapDebug, &clockDebug,
           &uiDebug, str);
+  fscanf (fconfig, "%d %d %d %59s\n", &cpuEngine, &jitThreshold, &freeRun, str);
+  fscanf (fconfig, "%d %d %59s\n", &numCores, &coreAffinity, str);
+  fscanf (fconfig, "%d %59s\n", &runAhead, str);
+  fscanf (fconfig, "%d %59s\n", &traceMode, str);
+  fscanf (fconfig, "%d %59s\n", &ckptRestore, str);
+  fscanf (fconfig, "%d %d %d %d %59s\n",
+          &cacheModel, &stallsToClock, &L2stall, &memStall, str);
+  fscanf (fconfig, "%d %d %d %d %d %d %59s\n", &L1lines, &L1assoc,
+          &L2lines, &L2assoc, &lineWords, &cacheRepl, str);
+  fscanf (fconfig, "%d %d %d %d %59s\n", &osCost[osSwitch], &osCost[osFault],
+          &osCost[osInterrupt], &osCost[osTimer], str);
   fclose (fconfig);
 
   bugF = fopen ("debug.tmp", "w");
   infF = stdout;
   // bugF = stderr;
+
+  if (numCores < 1) numCores = 1;
+  initialize_trace ();   // a replay takes the parameters of its trace
+  if (ckptRestore && !traceMode) checkpoint_config ();   // so does a checkpoint
+  if (numCores > 1 && freeRun)   // numCores may come from the checkpoint
+  { fprintf (infF, "Free-running mode needs a single core, turned off\n");
+    freeRun = 0;
+  } // the cores run on their own clocks, device timers would go out of order
 }
 
 void initialize_system ()
@@ -33,8 +52,13 @@ void initialize_system ()
   configure_system ();
 
   //========== initialize the data structures in the main thread
-  initialize_timer ();
   initialize_cpu ();
+  initialize_timer ();
+  initialize_icache ();
+  if (cpuEngine == jitEngine) initialize_jit ();
+  initialize_vector ();
+  initialize_profiler ();
+  initialize_cache ();
   initialize_physical_memory ();  // 3 memory initialization
   initialize_mframe_manager ();
   initialize_process_manager ();
@@ -42,11 +66,16 @@ void initialize_system ()
   //========== start the other two threads
   start_terminal ();   // term.c
   start_swap_manager ();   // swap.c
+  start_cores ();   // process.c, cores other than the boot core
+
+  if (ckptRestore) restore_checkpoint ();   // skip the warm-up
 }
 
 void system_exit ()
 {
   // wait for the other threads to clean up and terminate
+  end_cores ();
+  end_trace ();
   end_terminal ();
   end_swap_manager ();
 
@@ -62,7 +91,8 @@ void main ()
   // admin's T command sets systemActive to 0, stop all threads
 
   initialize_system ();
-  process_admin_commands ();
+  if (traceMode == traceReplay) replay_trace ();
+  else process_admin_commands ();
 
   fprintf (infF, "System exiting!!!\n");
   system_exit ();
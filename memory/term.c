@@ -3,6 +3,7 @@
 #include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "simos.h"
 
 //=========================================================================
@@ -31,7 +32,7 @@ char *outstr;
 {
   fprintf (fterm, "%s\n", outstr);
   fflush (fterm);
-  usleep (termPrintTime);
+  if (!freeRun) usleep (termPrintTime);
 }
 
 //=========================================================================
@@ -55,6 +56,11 @@ sem_t term_semaphor;
 
 sem_t term_mutex;
 
+// free-running mode, same as the disk in swap.c: insert_termIO sets an
+// actTermDone timer, the terminal thread posts term_done after printing
+sem_t term_done;
+int termBusyUntil = 0;
+
 
 // dump terminal queue is not called inside the terminal thread,
 // only called by admin.c
@@ -78,6 +84,9 @@ int pid, type;
 char *outstr;
 { TermQnode *node;
 
+  if (type == regularIO) account_state (pid, rsTermWait);
+  if (traceMode == traceReplay)   // no terminal thread, see trace.c
+  { terminal_output (pid, outstr); free (outstr); return; }
   sem_wait(&term_mutex);
 
   if (termDebug) printf ("Insert term queue %d %s\n", pid, outstr);
@@ -90,6 +99,9 @@ char *outstr;
   { termQtail = node; termQhead = node; }
   else // insert to tail
   { termQtail->next = node; termQtail = node; }
+  if (freeRun)
+    add_timer (device_delay (&termBusyUntil, termPrintTime),
+               (type != exitProgIO) ? pid : nullPid, actTermDone, oneTimeTimer);
   if (termDebug) dump_termIO_queue (bugF);
   sem_post(&term_semaphor);
   sem_post(&term_mutex);
@@ -109,7 +121,10 @@ void handle_one_termio ()
   else
   { node = termQhead;
     terminal_output (node->pid, node->str);
-    if (node->type != exitProgIO)
+    if (freeRun) sem_post(&term_done);  // the actTermDone timer notifies
+    else if (node->type != exitProgIO && traceMode == traceRecord)
+      trace_device_done (node->pid, -1);   // the core takes it in
+    else if (node->type != exitProgIO)
     {
       insert_endIO_list (node->pid);
       set_interrupt (endIOinterrupt);
@@ -125,6 +140,62 @@ void handle_one_termio ()
   }
 }
 
+// called by clock.c (main thread) when the actTermDone timer expires
+void wait_term_done ()
+{
+  sem_wait(&term_done);
+}
+
+//=====================================================
+// checkpoint (checkpoint.c): the terminal queue, with the strings
+// the terminal thread is held on term_mutex, so a string that is being
+// printed is still in the queue and is printed again after a restore
+//=====================================================
+
+void lock_termQ () { sem_wait(&term_mutex); }
+void unlock_termQ () { sem_post(&term_mutex); }
+int termQ_empty () { return (termQhead == NULL); }
+
+void checkpoint_term ()
+{ TermQnode *node;
+  int n;
+
+  for (n=0, node=termQhead; node!=NULL; node=node->next) n++;
+  ckpt_write_int (n);
+  for (node=termQhead; node!=NULL; node=node->next)
+  { ckpt_write_int (node->pid); ckpt_write_int (node->type);
+    n = strlen (node->str) + 1;
+    ckpt_write_int (n);
+    ckpt_write (node->str, n);
+  }
+  sem_getvalue (&term_done, &n);
+  ckpt_write_int (n);
+  ckpt_write_int (termBusyUntil);
+}
+
+// the queue is empty (checkpoint.c checks it), the thread is waiting
+void restore_term ()
+{ TermQnode *node;
+  int n, len;
+
+  for (n = ckpt_read_int (); n > 0; n--)
+  { node = (TermQnode *) malloc (sizeof (TermQnode));
+    node->pid = ckpt_read_int (); node->type = ckpt_read_int ();
+    len = ckpt_read_int ();
+    node->str = (char *) malloc (len);
+    memcpy (node->str, ckpt_read (len), len);
+    node->next = NULL;
+    if (termQtail == NULL) termQhead = node; else termQtail->next = node;
+    termQtail = node;
+  }
+  n = ckpt_read_int ();
+  while (sem_trywait (&term_done) == 0);
+  while (n-- > 0) sem_post (&term_done);
+  termBusyUntil = ckpt_read_int ();
+  if (termQhead != NULL && traceMode != traceReplay)
+    sem_post(&term_semaphor);   // wake the terminal thread up
+}
+
 //=====================================================
 // loop on handle_one_termIO to process the termIO requests
 // This has to be a separate thread to loop for request handling
@@ -134,6 +205,7 @@ void handle_one_termio ()
 
 void *termIO ()
 {
+  bind_core (bootCore);   // the terminal interrupts core 0
   while (systemActive) handle_one_termio ();
   if (termDebug) printf ("TermIO loop has ended\n");
 }
@@ -144,9 +216,11 @@ void start_terminal ()
 { int ret;
   sem_init(&term_semaphor,0,1);
   sem_init(&term_mutex,0,1);
+  sem_init(&term_done,0,0);
   sem_wait(&term_semaphor);
 
   fterm = fopen (termFN, "w");
+  if (traceMode == traceReplay) return;   // output is written at insert
   ret = pthread_create (&termThread, NULL, termIO, NULL);
   if (ret < 0) printf ("Error ! TermIO Thread Creation \n");
   else printf ("TermIO thread is created\n");
@@ -157,6 +231,7 @@ void end_terminal ()
   sem_post(&term_semaphor); sem_post(&term_mutex); //**DG
 
   fclose (fterm);
+  if (traceMode == traceReplay) return;
   ret = pthread_join (termThread, NULL);
   printf ("TermIO thread has terminated %d\n", ret);
 }
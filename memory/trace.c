@@ -0,0 +1,455 @@
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <semaphore.h>
+#include <time.h>
+#include "simos.h"
+
+//=========================================================================
+// Instruction trace recorder and deterministic replay
+// traceMode 1 records a run into "simos.trace": every instruction retired
+//    (its pc), data access (offset), interrupt dispatched, process put on
+//    the core and taken off it, and the asynchronous inputs: terminal and
+//    disk completions and program submissions
+// traceMode 2 replays the trace: the same run is driven again without the
+//    terminal and swap threads, the asynchronous inputs are fed in at the
+//    recorded cycles and every other record is compared with what the run
+//    does; the first divergence is reported, with the host time of the
+//    replay, so a change can be checked (and bisected) for both
+//    correctness and speed on the very same run
+// To make the inputs land at a known cycle, in both modes the devices do
+//    not take their completions in themselves: they queue them here and
+//    raise endIO, the core takes them in when it dispatches the interrupt
+//    (trace_take_devices), terminal done => endIO list, disk read done =>
+//    the page is put in memory (swap_read_done, swap.c)
+// Only the switch engine on a single core in real-time mode can be traced
+//
+// A record is one byte, type in the low 4 bits and cycles since the last
+//    record in the high 4 bits (15: the count follows as a varint), then
+//    its values as varints: pc and offset are taken as the (zigzag) delta
+//    from the previous one, which keeps most records at 2 bytes
+//=========================================================================
+
+#define traceFname "simos.trace"
+#define traceMagic 0x53545231   // "STR1"
+
+// record types
+#define trRetire 1     // pc of the instruction
+#define trRead 2       // data offset read
+#define trWrite 3      // data offset written
+#define trInterrupt 4  // interrupt bit dispatched
+#define trSchedIn 5    // pid put on the core (idlePid for idle)
+#define trSchedOut 6   // exeStatus of the process taken off the core
+#define trTermDone 7   // terminal output done: pid
+#define trDiskDone 8   // swap read done: pid, page
+#define trSubmit 9     // program submitted: file name
+#define trEnd 10       // end of the run
+#define trAsync(type) ((type) >= trTermDone && (type) <= trSubmit)
+
+char *trName[] = { "", "retire", "read", "write", "interrupt", "schedule-in",
+                   "schedule-out", "term-done", "disk-done", "submit", "end" };
+
+//==========================
+// record
+//==========================
+
+FILE *ftrace;
+int lastCycle, lastPC, lastOffset;   // the deltas are taken from them
+long long numRecords;
+
+void put_varint (unsigned v)
+{
+  while (v >= 0x80) { putc_unlocked ((v & 0x7f) | 0x80, ftrace); v >>= 7; }
+  putc_unlocked (v, ftrace);
+}
+
+unsigned zigzag (int v)
+{ return (((unsigned) v << 1) ^ (unsigned) (v >> 31)); }
+
+int unzigzag (unsigned v)
+{ return ((int) (v >> 1) ^ -(int) (v & 1)); }
+
+void put_record (int type)
+{ unsigned delta;
+
+  delta = CPU.numCycles - lastCycle;
+  lastCycle = CPU.numCycles;
+  if (delta < 15) putc_unlocked (type | (delta << 4), ftrace);
+  else { putc_unlocked (type | 0xf0, ftrace); put_varint (delta - 15); }
+  numRecords++;
+}
+
+//==========================
+// read back, a cursor decodes the records one by one
+// replay has two: one checks the run, one feeds the asynchronous inputs
+//==========================
+
+typedef struct
+{ int pos, cycle, pc, offset;   // position, the delta bases
+  int endIOs;   // #endIO dispatches passed
+  int type, value, value2, dispatch;   // the current record
+  char name[100];
+} typeTraceCursor;
+
+unsigned char *traceBuf;
+int traceLen;
+
+unsigned get_varint (typeTraceCursor *c)
+{ unsigned v = 0;
+  int shift = 0;
+
+  while (c->pos < traceLen && (traceBuf[c->pos] & 0x80))
+  { v |= (traceBuf[c->pos++] & 0x7f) << shift; shift += 7; }
+  if (c->pos < traceLen) v |= traceBuf[c->pos++] << shift;
+  return (v);
+}
+
+// decode the next record into the cursor, returns its type
+int next_record (typeTraceCursor *c)
+{ int b, n;
+
+  if (c->pos >= traceLen) { c->type = trEnd; return (trEnd); }
+  b = traceBuf[c->pos++];
+  c->type = b & 0xf;
+  if ((b >> 4) == 15) c->cycle = c->cycle + 15 + get_varint (c);
+  else c->cycle = c->cycle + (b >> 4);
+  c->value = c->value2 = 0;
+  switch (c->type)
+  { case trRetire:
+      c->pc = c->pc + 1 + unzigzag (get_varint (c));
+      c->value = c->pc; break;
+    case trRead: case trWrite:
+      c->offset = c->offset + unzigzag (get_varint (c));
+      c->value = c->offset; break;
+    case trInterrupt:
+      c->value = get_varint (c);
+      if (c->value == endIOinterrupt) c->endIOs++;
+      break;
+    case trSchedIn: case trSchedOut: case trTermDone:
+      c->value = get_varint (c); break;
+    case trDiskDone:
+      c->value = get_varint (c); c->value2 = get_varint (c); break;
+    case trSubmit:
+      n = get_varint (c);
+      if (n > 99) n = 99;
+      memcpy (c->name, &traceBuf[c->pos], n); c->name[n] = '\0';
+      c->pos = c->pos + n; break;
+    case trEnd: break;
+    default:
+      fprintf (infF, "Trace: bad record type %d at byte %d\n",
+               c->type, c->pos - 1);
+      c->pos = traceLen; c->type = trEnd;
+  }
+  c->dispatch = c->endIOs;   // a completion belongs to the last endIO
+  return (c->type);
+}
+
+typeTraceCursor checkCur, asyncCur;
+int endCycle;   // cycle of the trEnd record
+
+// the next asynchronous input (or trEnd) in asyncCur
+void next_async ()
+{
+  do next_record (&asyncCur);
+  while (!trAsync (asyncCur.type) && asyncCur.type != trEnd);
+}
+
+//==========================
+// replay check
+//==========================
+
+long long numChecked;
+int replayDiverged, endIOsDone;
+
+void check_record (int type, int value)
+{
+  if (replayDiverged) return;
+  do next_record (&checkCur); while (trAsync (checkCur.type));
+  if (checkCur.type == type && checkCur.cycle == CPU.numCycles
+      && checkCur.value == value)
+  { numChecked++; return; }
+  replayDiverged = 1;
+  fprintf (infF, "Replay diverged after %lld records, at cycle %d:\n",
+           numChecked, CPU.numCycles);
+  fprintf (infF, "  trace: %s %d at cycle %d, run: %s %d (pid %d, pc %d)\n",
+           trName[checkCur.type], checkCur.value, checkCur.cycle,
+           trName[type], value, CPU.Pid, CPU.PC);
+}
+
+//==========================
+// hooks, called when traceMode is on
+//==========================
+
+void trace_retire (int pc)
+{
+  if (traceMode == traceReplay) { check_record (trRetire, pc); return; }
+  put_record (trRetire);
+  put_varint (zigzag (pc - lastPC - 1));
+  lastPC = pc;
+}
+
+void trace_access (int offset, int rwflag)
+{ int type;
+
+  type = (rwflag == flagWrite) ? trWrite : trRead;
+  if (traceMode == traceReplay) { check_record (type, offset); return; }
+  put_record (type);
+  put_varint (zigzag (offset - lastOffset));
+  lastOffset = offset;
+}
+
+void trace_interrupt (unsigned bit)
+{
+  if (traceMode == traceReplay) { check_record (trInterrupt, bit); return; }
+  put_record (trInterrupt);
+  put_varint (bit);
+}
+
+void trace_schedule_in (int pid)
+{
+  if (traceMode == traceReplay) { check_record (trSchedIn, pid); return; }
+  put_record (trSchedIn);
+  put_varint (pid);
+}
+
+void trace_schedule_out (int status)
+{
+  if (traceMode == traceReplay) { check_record (trSchedOut, status); return; }
+  put_record (trSchedOut);
+  put_varint (status);
+}
+
+// record only, the main thread submits between rounds
+void trace_submit (char *fname)
+{ int n;
+
+  n = strlen (fname);
+  put_record (trSubmit);
+  put_varint (n);
+  fwrite (fname, 1, n, ftrace);
+}
+
+//==========================
+// device completions
+// record: the terminal and swap threads queue them, the core takes them
+//    in when it dispatches endIO and records them
+// replay: queued by trace_take_devices from the trace
+//==========================
+
+#define initDevDone 256   // first size of the queue, doubled when full
+
+typedef struct
+{ int pid, page;   // page < 0: terminal
+} typeDevDone;
+
+typeDevDone *devDone = NULL;   // a ring of devSize entries
+int devSize = 0, devHead = 0, devTail = 0;
+sem_t dev_mutex;
+
+// double the ring, the queued completions move to its front
+// a completion is never dropped, nor does the device thread wait for the
+// core: the terminal thread holds term_mutex, which the core may need
+void grow_dev_queue ()
+{ typeDevDone *q;
+  int i, n;
+
+  n = (devSize == 0) ? initDevDone : 2*devSize;
+  q = (typeDevDone *) malloc (n*sizeof(typeDevDone));
+  i = 0;
+  for (; devHead != devTail; devHead = (devHead + 1) % devSize)
+    q[i++] = devDone[devHead];
+  free (devDone);
+  devDone = q; devSize = n;
+  devHead = 0; devTail = i;
+}
+
+// called by the device threads, page is -1 for the terminal
+void trace_device_done (int pid, int page)
+{
+  sem_wait (&dev_mutex);
+  if (devSize == 0 || (devTail + 1) % devSize == devHead) grow_dev_queue ();
+  devDone[devTail].pid = pid; devDone[devTail].page = page;
+  devTail = (devTail + 1) % devSize;
+  set_interrupt (endIOinterrupt);
+  sem_post (&dev_mutex);
+}
+
+// replay: the inputs of this endIO dispatch
+void replay_devices ()
+{
+  endIOsDone++;
+  while ((asyncCur.type == trTermDone || asyncCur.type == trDiskDone)
+         && asyncCur.dispatch == endIOsDone)
+  { if (asyncCur.type == trTermDone) insert_endIO_list (asyncCur.value);
+    else if (!swap_read_done (asyncCur.value, asyncCur.value2)
+             && !replayDiverged)
+    { replayDiverged = 1;
+      fprintf (infF, "Replay diverged at cycle %d: ", CPU.numCycles);
+      fprintf (infF, "disk read of pid/page %d,%d is not in the swap queue\n",
+               asyncCur.value, asyncCur.value2);
+    }
+    next_async ();
+  }
+  trace_inject ();   // the next completion may come at the same cycle
+}
+
+// called by handle_interrupt (cpu.c) for endIO, before endIO_moveto_ready
+void trace_take_devices ()
+{ typeDevDone d;
+
+  if (traceMode == traceReplay) { replay_devices (); return; }
+  sem_wait (&dev_mutex);
+  while (devHead != devTail)
+  { d = devDone[devHead];
+    devHead = (devHead + 1) % devSize;
+    sem_post (&dev_mutex);
+    if (d.page < 0)
+    { put_record (trTermDone); put_varint (d.pid);
+      insert_endIO_list (d.pid);
+    }
+    else
+    { put_record (trDiskDone); put_varint (d.pid); put_varint (d.page);
+      swap_read_done (d.pid, d.page);
+    }
+    sem_wait (&dev_mutex);
+  }
+  clear_interrupt (endIOinterrupt);
+    // all the completions raised so far are in, another one raises it again
+  sem_post (&dev_mutex);
+}
+
+//==========================
+// replay of the asynchronous inputs
+//==========================
+
+// called before the interrupt check of the switch engine and the idle loop
+void trace_inject ()
+{
+  if ((asyncCur.type == trTermDone || asyncCur.type == trDiskDone)
+      && asyncCur.cycle <= CPU.numCycles)
+    set_interrupt (endIOinterrupt);
+}
+
+// the batch of the switch engine ends at the next input
+int trace_budget (int budget)
+{ int n;
+
+  if (asyncCur.type == trTermDone || asyncCur.type == trDiskDone)
+  { n = asyncCur.cycle - CPU.numCycles + 1;
+    if (n < 1) n = 1;
+    if (n < budget) budget = n;
+  }
+  return (budget);
+}
+
+// called at the start of execute_process: the submissions of this round
+void trace_round ()
+{
+  while (asyncCur.type == trSubmit && asyncCur.cycle <= CPU.numCycles)
+  { submit_process (asyncCur.name);
+    next_async ();
+  }
+}
+
+//==========================
+// start and end
+//==========================
+
+// trace header: the parameters the run depends on, replay takes them over
+int *traceParams[] =
+{ &maxProcess, &cpuQuantum, &idleQuantum, &pageSize, &numFrames,
+  &loadPpages, &maxPpages, &OSpages, &agescanPeriod, &runAhead };
+#define numTraceParams ((int) (sizeof(traceParams)/sizeof(traceParams[0])))
+
+void record_header ()
+{ int i;
+
+  ftrace = fopen (traceFname, "w");
+  if (ftrace == NULL) { perror ("Error open trace: "); exit (-1); }
+  setvbuf (ftrace, NULL, _IOFBF, 1<<20);
+  put_varint (traceMagic);
+  for (i=0; i<numTraceParams; i++) put_varint (*traceParams[i]);
+  fprintf (infF, "Recording the run to %s\n", traceFname);
+}
+
+void load_trace ()
+{ FILE *f;
+  typeTraceCursor c;
+  long long n;
+  int i;
+
+  f = fopen (traceFname, "r");
+  if (f == NULL) { perror ("Error open trace: "); exit (-1); }
+  fseek (f, 0, SEEK_END); traceLen = ftell (f); fseek (f, 0, SEEK_SET);
+  traceBuf = (unsigned char *) malloc (traceLen);
+  if ((long long) fread (traceBuf, 1, traceLen, f) != traceLen)
+  { printf ("Error reading %s\n", traceFname); exit (-1); }
+  fclose (f);
+
+  memset (&c, 0, sizeof(c));
+  if (get_varint (&c) != traceMagic)
+  { printf ("Error: %s is not a trace\n", traceFname); exit (-1); }
+  for (i=0; i<numTraceParams; i++) *traceParams[i] = get_varint (&c);
+  checkCur = c;   // the records start here
+  for (n=0; next_record (&c) != trEnd; n++);
+  endCycle = c.cycle;
+  asyncCur = checkCur;
+  next_async ();
+  fprintf (infF, "Replaying %s: %lld records, %d cycles\n",
+           traceFname, n, endCycle);
+}
+
+// called by configure_system, before the modules are initialized
+void initialize_trace ()
+{
+  if (traceMode != traceRecord && traceMode != traceReplay)
+  { traceMode = traceOff; return; }
+  if (numCores > 1)
+  { fprintf (infF, "Tracing needs a single core, turned off\n");
+    traceMode = traceOff; return;
+  }
+  if (freeRun)
+  { fprintf (infF, "Free-running mode is turned off for tracing\n");
+    freeRun = 0;
+  } // the device completions are timed by the host
+  sem_init (&dev_mutex, 0, 1);
+  if (traceMode == traceRecord) record_header ();
+  else
+  { load_trace ();
+    instrTime = 0; termPrintTime = 0; diskRWtime = 0;
+      // there are no device threads to wait for, run as fast as it goes
+  }
+}
+
+// record: called by system_exit
+void end_trace ()
+{
+  if (traceMode != traceRecord) return;
+  put_record (trEnd);
+  fclose (ftrace);
+  fprintf (infF, "Trace %s: %lld records, %d cycles\n",
+           traceFname, numRecords, CPU.numCycles);
+}
+
+// replay driver, in place of the admin commands
+void replay_trace ()
+{ struct timespec t0, t1;
+
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  while (CPU.numCycles < endCycle && !replayDiverged) execute_process ();
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  if (!replayDiverged)
+  { do next_record (&checkCur); while (trAsync (checkCur.type));
+    if (checkCur.type != trEnd)
+      fprintf (infF, "Replay diverged: the run ended at cycle %d before %s\n",
+               CPU.numCycles, trName[checkCur.type]);
+    else
+      fprintf (infF, "Replay is identical to the trace: %lld records\n",
+               numChecked);
+  }
+  fprintf (infF, "Replay took %.3f s for %d cycles\n",
+           (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9,
+           CPU.numCycles);
+  systemActive = 0;
+}
@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simos.h"
+
+//=========================================================================
+// Vector instructions, executed by cpu.c on a contiguous range of mdType
+//    OPvadd   dst, src, n : M[dst+i] = M[dst+i] + M[src+i], i = 0..n-1
+//    OPvmul   dst, src, n : M[dst+i] = M[dst+i] * M[src+i]
+//    OPvsum   src, n      : AC = M[src] + ... + M[src+n-1]
+//    OPvscale dst, n      : M[dst+i] = M[dst+i] * AC
+// and block memory instructions, which move whole words
+//    OPmemcpy dst, src, n : M[dst+i] = M[src+i], overlapping ranges give
+//                           the same result as a load/store loop over i
+//    OPmemset dst, n      : M[dst+i] = AC
+// Like OPifgo, they take more than one word, each extra word repeats the
+//    opcode and carries the next operand (e.g. "10 40", "10 48", "10 8")
+// The range is processed a page at a time: the src and dst pages are
+//    translated once, then the host kernel runs on the frames directly
+// CPU.VIndex counts the elements done. On a page fault the instruction
+//    stops with PC unchanged and is re-executed after the page is in,
+//    it then continues at VIndex (VIndex is saved in the PCB)
+// The kernels use AVX2 or SSE when the host has them, otherwise scalar
+//    (float and double data only, see vecSIMD below).
+//    The reduction always adds in the same 8-lane order, so OPvsum gives
+//    the same result on any host.
+//=========================================================================
+
+#define vecLanes 8   // lanes of the reduction, = floats in an AVX register
+
+// SIMD needs the data packed, one mdType per word: float in 32-bit words
+// or double (always 64-bit words); integer data use the scalar kernels
+#if defined(__x86_64__) && \
+    ((defined(mdFloat) && !defined(wideWord)) || defined(mdDouble))
+#include <immintrin.h>
+#define vecSIMD
+#endif
+
+#define vecScalar 0
+#define vecSSE 1
+#define vecAVX2 2
+int vecLevel = vecScalar;
+
+void initialize_vector ()
+{
+#ifdef vecSIMD
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2")) vecLevel = vecAVX2;
+  else vecLevel = vecSSE;   // SSE2 is part of x86-64
+#endif
+  if (cpuDebug) fprintf (bugF, "Vector: kernel level %d\n", vecLevel);
+}
+
+// #words of a vector instruction, 0 if opcode is not one
+int vector_length (int opcode)
+{
+  switch (opcode)
+  { case OPvadd: case OPvmul: case OPmemcpy: return (3);
+    case OPvsum: case OPvscale: case OPmemset: return (2);
+    default: return (0);
+  }
+}
+
+//=====================================
+// host kernels
+//=====================================
+
+// scalar kernels work on memory words, so they do not depend on the
+// word format; the SIMD kernels below need one mdType per word
+void vadd_scalar (mType *d, mType *s, int n)
+{ int i;
+  for (i=0; i<n; i++) d[i].mData = d[i].mData + s[i].mData;
+}
+
+void vmul_scalar (mType *d, mType *s, int n)
+{ int i;
+  for (i=0; i<n; i++) d[i].mData = d[i].mData * s[i].mData;
+}
+
+void vscale_scalar (mType *d, mdType a, int n)
+{ int i;
+  for (i=0; i<n; i++) d[i].mData = d[i].mData * a;
+}
+
+mdType vsum_scalar (mType *s, int n)
+{ mdType acc[vecLanes], sum;
+  int i, k;
+
+  for (k=0; k<vecLanes; k++) acc[k] = 0;
+  for (i=0; i+vecLanes<=n; i+=vecLanes)
+    for (k=0; k<vecLanes; k++) acc[k] = acc[k] + s[i+k].mData;
+  sum = 0;
+  for (k=0; k<vecLanes; k++) sum = sum + acc[k];
+  for (; i<n; i++) sum = sum + s[i].mData;
+  return (sum);
+}
+
+#ifdef vecSIMD
+
+// vecTypeS/vecTypeA: SSE/AVX register of mdType, widthS/widthA lanes
+#ifdef mdFloat
+#define vecTypeS __m128
+#define vecTypeA __m256
+#define widthS 4
+#define widthA 8
+#define opS(op) _mm_##op##_ps
+#define opA(op) _mm256_##op##_ps
+#else   // mdDouble
+#define vecTypeS __m128d
+#define vecTypeA __m256d
+#define widthS 2
+#define widthA 4
+#define opS(op) _mm_##op##_pd
+#define opA(op) _mm256_##op##_pd
+#endif
+
+void vadd_sse (mdType *d, mdType *s, int n)
+{ int i;
+  for (i=0; i+widthS<=n; i+=widthS)
+    opS(storeu) (d+i, opS(add) (opS(loadu) (d+i), opS(loadu) (s+i)));
+  vadd_scalar ((mType *) (d+i), (mType *) (s+i), n-i);
+}
+
+void vmul_sse (mdType *d, mdType *s, int n)
+{ int i;
+  for (i=0; i+widthS<=n; i+=widthS)
+    opS(storeu) (d+i, opS(mul) (opS(loadu) (d+i), opS(loadu) (s+i)));
+  vmul_scalar ((mType *) (d+i), (mType *) (s+i), n-i);
+}
+
+void vscale_sse (mdType *d, mdType a, int n)
+{ vecTypeS va = opS(set1) (a);
+  int i;
+  for (i=0; i+widthS<=n; i+=widthS)
+    opS(storeu) (d+i, opS(mul) (opS(loadu) (d+i), va));
+  vscale_scalar ((mType *) (d+i), a, n-i);
+}
+
+mdType vsum_sse (mdType *s, int n)   // register j holds lanes j*widthS ..
+{ vecTypeS v[vecLanes/widthS];
+  mdType acc[vecLanes], sum;
+  int i, j, k;
+
+  for (j=0; j<vecLanes/widthS; j++) v[j] = opS(setzero) ();
+  for (i=0; i+vecLanes<=n; i+=vecLanes)
+    for (j=0; j<vecLanes/widthS; j++)
+      v[j] = opS(add) (v[j], opS(loadu) (s+i+j*widthS));
+  for (j=0; j<vecLanes/widthS; j++) opS(storeu) (acc+j*widthS, v[j]);
+  sum = 0;
+  for (k=0; k<vecLanes; k++) sum = sum + acc[k];
+  for (; i<n; i++) sum = sum + s[i];
+  return (sum);
+}
+
+__attribute__ ((target ("avx2")))
+void vadd_avx2 (mdType *d, mdType *s, int n)
+{ int i;
+  for (i=0; i+widthA<=n; i+=widthA)
+    opA(storeu) (d+i, opA(add) (opA(loadu) (d+i), opA(loadu) (s+i)));
+  vadd_scalar ((mType *) (d+i), (mType *) (s+i), n-i);
+}
+
+__attribute__ ((target ("avx2")))
+void vmul_avx2 (mdType *d, mdType *s, int n)
+{ int i;
+  for (i=0; i+widthA<=n; i+=widthA)
+    opA(storeu) (d+i, opA(mul) (opA(loadu) (d+i), opA(loadu) (s+i)));
+  vmul_scalar ((mType *) (d+i), (mType *) (s+i), n-i);
+}
+
+__attribute__ ((target ("avx2")))
+void vscale_avx2 (mdType *d, mdType a, int n)
+{ vecTypeA va = opA(set1) (a);
+  int i;
+  for (i=0; i+widthA<=n; i+=widthA)
+    opA(storeu) (d+i, opA(mul) (opA(loadu) (d+i), va));
+  vscale_scalar ((mType *) (d+i), a, n-i);
+}
+
+__attribute__ ((target ("avx2")))
+mdType vsum_avx2 (mdType *s, int n)
+{ vecTypeA v[vecLanes/widthA];
+  mdType acc[vecLanes], sum;
+  int i, j, k;
+
+  for (j=0; j<vecLanes/widthA; j++) v[j] = opA(setzero) ();
+  for (i=0; i+vecLanes<=n; i+=vecLanes)
+    for (j=0; j<vecLanes/widthA; j++)
+      v[j] = opA(add) (v[j], opA(loadu) (s+i+j*widthA));
+  for (j=0; j<vecLanes/widthA; j++) opA(storeu) (acc+j*widthA, v[j]);
+  sum = 0;
+  for (k=0; k<vecLanes; k++) sum = sum + acc[k];
+  for (; i<n; i++) sum = sum + s[i];
+  return (sum);
+}
+
+#endif
+
+// block copy and fill, on whole memory words
+void block_copy (mType *d, mType *s, int n)
+{
+  memmove (d, s, n*sizeof(mType));
+}
+
+void block_fill (mType *d, mdType v, int n)
+{ mType w;
+  int done, k;
+
+  w.mInstr = 0;
+  w.mData = v;
+  if (w.mInstr == 0) { memset (d, 0, n*sizeof(mType)); return; }
+  d[0] = w;
+  for (done=1; done<n; done=done+k)   // double the filled part each time
+  { k = (done < n-done) ? done : n-done;
+    memcpy (d+done, d, k*sizeof(mType));
+  }
+}
+
+// run the kernel of opcode on n elements, d and s are host addresses
+void vector_kernel (int opcode, mType *dw, mType *sw, int n)
+{
+  if (opcode == OPmemcpy) { block_copy (dw, sw, n); return; }
+  if (opcode == OPmemset) { block_fill (dw, CPU.AC, n); return; }
+#ifdef vecSIMD
+  mdType *d = &dw->mData, *s = &sw->mData;
+
+  if (vecLevel == vecAVX2)
+    switch (opcode)
+    { case OPvadd: vadd_avx2 (d, s, n); return;
+      case OPvmul: vmul_avx2 (d, s, n); return;
+      case OPvsum: CPU.AC = CPU.AC + vsum_avx2 (s, n); return;
+      case OPvscale: vscale_avx2 (d, CPU.AC, n); return;
+    }
+  if (vecLevel == vecSSE)
+    switch (opcode)
+    { case OPvadd: vadd_sse (d, s, n); return;
+      case OPvmul: vmul_sse (d, s, n); return;
+      case OPvsum: CPU.AC = CPU.AC + vsum_sse (s, n); return;
+      case OPvscale: vscale_sse (d, CPU.AC, n); return;
+    }
+#endif
+  switch (opcode)
+  { case OPvadd: vadd_scalar (dw, sw, n); return;
+    case OPvmul: vmul_scalar (dw, sw, n); return;
+    case OPvsum: CPU.AC = CPU.AC + vsum_scalar (sw, n); return;
+    case OPvscale: vscale_scalar (dw, CPU.AC, n); return;
+  }
+}
+
+//=====================================
+// fetch and execute, called by cpu.c
+//=====================================
+
+// fetch the operands of the extra words into IRoperand2, IRoperand3
+// IRopcode and IRoperand (first word) are not touched
+int vector_fetch ()
+{ int k, len, maddr, operand[3];
+
+  len = vector_length (CPU.IRopcode);
+  for (k=1; k<len; k++)
+  { maddr = calculate_memory_address (CPU.PC+k, flagRead);
+    if (maddr == mError || maddr == mPFault) return (maddr);
+    operand[k] = Memory[maddr].mInstr & operandMask;
+  }
+  CPU.IRoperand2 = operand[1];
+  if (len > 2) CPU.IRoperand3 = operand[2];
+  return (mNormal);
+}
+
+// translate offset for rwflag, set exeStatus if it cannot be accessed
+int vector_translate (int offset, int rwflag)
+{ int maddr;
+
+  maddr = calculate_memory_address (offset, rwflag);
+  if (traceMode) trace_access (offset, rwflag);
+  if (maddr == mError) { CPU.exeStatus = eError; CPU.VIndex = 0; }
+  else if (maddr == mPFault) CPU.exeStatus = ePFault;
+    // VIndex is kept, the re-execution continues from there
+  return (maddr);
+}
+
+// execute the fetched vector instruction from element VIndex on
+// on completion, PC is on the last word (cpu.c does the final PC++)
+void vector_execute ()
+{ int opcode, dst, src, n, chunk, d, s, dmaddr, smaddr;
+
+  opcode = CPU.IRopcode;
+  dst = -1; src = -1;
+  if (opcode == OPvadd || opcode == OPvmul || opcode == OPmemcpy)
+  { dst = CPU.IRoperand; src = CPU.IRoperand2; n = CPU.IRoperand3; }
+  else if (opcode == OPvsum) { src = CPU.IRoperand; n = CPU.IRoperand2; }
+  else { dst = CPU.IRoperand; n = CPU.IRoperand2; }
+  if (opcode == OPvsum && CPU.VIndex == 0) CPU.AC = 0;
+
+  while (CPU.VIndex < n)
+  { // stay within the current dst and src pages
+    chunk = n - CPU.VIndex;
+    d = dst + CPU.VIndex;
+    s = src + CPU.VIndex;
+    if (src >= 0 && pageSize - s % pageSize < chunk)
+      chunk = pageSize - s % pageSize;
+    if (dst >= 0 && pageSize - d % pageSize < chunk)
+      chunk = pageSize - d % pageSize;
+    if (opcode == OPmemcpy && d > s && d - s < chunk) chunk = d - s;
+      // forward overlap: each chunk only reads words already final
+    smaddr = 0; dmaddr = 0;
+    if (dst >= 0)   // first: a write to a null page takes a frame, which
+    { dmaddr = vector_translate (d, flagWrite);   // may be the src frame
+      if (CPU.exeStatus != eRun) return;
+    }
+    if (src >= 0)
+    { smaddr = vector_translate (s, flagRead);
+      if (CPU.exeStatus != eRun) return;
+    }
+    if (cacheModel)
+    { if (src >= 0) cache_access_range (smaddr, chunk, flagRead);
+      if (dst >= 0) cache_access_range (dmaddr, chunk, flagWrite);
+    }
+    vector_kernel (opcode, &Memory[dmaddr], &Memory[smaddr], chunk);
+    if (dst >= 0 && d < PCB[CPU.Pid]->dataOffset)
+      icache_invalidate_page (CPU.Pid, d/pageSize);
+      // store into a code page, same as put_data
+    CPU.VIndex = CPU.VIndex + chunk;
+  }
+  CPU.VIndex = 0;
+  CPU.PC = CPU.PC + vector_length (opcode) - 1;
+}